@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Generates access patterns for differential testing against the reference oracle.
+ *
+ * usage: accessgen <mode> <seed> <n>
+ *   random    random reads and writes of different sizes over 256 pages
+ *   codedata  reads from the program's own code pages, i.e., code and data share pages
+ *   boundary  unaligned accesses straddling page boundaries
+ *   burst     long phases without new pages, then bursts, so pages expire exactly at tau
+ *   purge     random accesses, and every 100 accesses madvise(DONTNEED/FREE) of a few pages
+ *   firsttouch fresh pages, first touched by a store or by a load, directly and through
+ *             memset/memcpy. Prints the address of the mapping.
+ */
+
+#define NPAGES 256
+
+static unsigned long x;
+
+static unsigned long lcg(void) {
+    x = x * 6364136223846793005UL + 1442695040888963407UL;
+    return x >> 17;
+}
+
+static unsigned long mode_random(char *buf, long ps, long n) {
+    unsigned long sum = 0;
+    for (long i = 0; i < n; ++i) {
+        const unsigned long r = lcg();
+        char *p = buf + (r % NPAGES) * ps + (r >> 20) % (ps - 16);
+        switch (r & 7) {
+            case 0: sum += *p; break;
+            case 1: *p = (char) i; break;
+            case 2: sum += *(int*) ((unsigned long) p & ~3UL); break;
+            case 3: *(long*) ((unsigned long) p & ~7UL) = i; break;
+            case 4: memcpy(p, buf + (r % 7) * ps, 16); break;
+            default: sum += p[1]; p[2] = (char) sum; break;
+        }
+    }
+    return sum;
+}
+
+static unsigned long mode_codedata(long n) {
+    const volatile unsigned char *code = (const volatile unsigned char *) (void *) &mode_codedata;
+    unsigned long sum = 0;
+    for (long i = 0; i < n; ++i) {
+        sum += code[i % 512];
+    }
+    return sum;
+}
+
+static unsigned long mode_boundary(char *buf, long ps, long n) {
+    unsigned long sum = 0;
+    for (long i = 0; i < n; ++i) {
+        char *p = buf + ((i * 7) % (NPAGES - 1) + 1) * ps - 1 - (i % 8);
+        unsigned long v;
+        __builtin_memcpy(&v, p, sizeof(v));
+        sum += v;
+        __builtin_memcpy(p, &sum, sizeof(sum));
+    }
+    return sum;
+}
+
+static unsigned long mode_burst(char *buf, long ps, long n) {
+    unsigned long sum = 0;
+    for (long r = 0; r < n; ++r) {
+        register unsigned long k = lcg() % 20000;
+        while (k--) sum += k;
+        for (long p = 0; p < 64; ++p) {
+            buf[((r * 64 + p) % NPAGES) * ps] += (char) sum;
+        }
+    }
+    return sum;
+}
+
+static unsigned long mode_purge(long ps, long n) {
+    char *buf = mmap(NULL, NPAGES * ps, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) return 0;
+    unsigned long sum = 0;
+    for (long i = 0; i < n; ++i) {
+        const unsigned long r = lcg();
+        buf[(r % NPAGES) * ps + (r >> 20) % ps] += (char) i;
+        if (i % 100 == 99) {
+            const long first = (r >> 8) % NPAGES;
+            long len = 1 + (r >> 16) % 16;
+            if (first + len > NPAGES) len = NPAGES - first;
+#ifdef MADV_FREE
+            const int advice = (r & 1) ? MADV_FREE : MADV_DONTNEED;
+#else
+            const int advice = MADV_DONTNEED;
+#endif
+            madvise(buf + first * ps, len * ps, advice);
+        }
+        sum += buf[((r >> 3) % NPAGES) * ps];
+    }
+    munmap(buf, NPAGES * ps);
+    return sum;
+}
+
+/* 4n pages: 4k stored first, 4k+1 loaded first (then stored), 4k+2 by memset,
+   4k+3 read by memcpy */
+static unsigned long mode_firsttouch(long ps, long n) {
+    volatile char *buf = mmap(NULL, 4 * n * ps, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) return 0;
+    printf("firsttouch %p\n", (void *) buf);
+    fflush(stdout);
+    /* length not known at compile time, so memset/memcpy are calls into libc */
+    const size_t len = ps / 64;
+    char *tmp = malloc(len);
+    unsigned long sum = 0;
+    for (long i = 0; tmp && i < n; ++i) {
+        buf[(4 * i) * ps] = (char) i;
+        sum += buf[(4 * i + 1) * ps];
+        buf[(4 * i + 1) * ps + 8] = (char) sum;
+        memset((char *) buf + (4 * i + 2) * ps, (int) i, len);
+        memcpy(tmp, (const char *) buf + (4 * i + 3) * ps, len);
+        sum += tmp[i % len];
+    }
+    free(tmp);
+    munmap((void *) buf, 4 * n * ps);
+    return sum;
+}
+
+int main(int argc, char**argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s random|codedata|boundary|burst|purge|firsttouch <seed> <n>\n", argv[0]);
+        return 1;
+    }
+    x = strtoul(argv[2], NULL, 10);
+    const long n = atol(argv[3]);
+    const long ps = sysconf(_SC_PAGESIZE);
+    char *buf = calloc(NPAGES, ps);
+    if (!buf) return 1;
+
+    unsigned long sum = 0;
+    if (!strcmp(argv[1], "random")) {
+        sum = mode_random(buf, ps, n);
+    } else if (!strcmp(argv[1], "codedata")) {
+        sum = mode_codedata(n);
+    } else if (!strcmp(argv[1], "boundary")) {
+        sum = mode_boundary(buf, ps, n);
+    } else if (!strcmp(argv[1], "burst")) {
+        sum = mode_burst(buf, ps, n);
+    } else if (!strcmp(argv[1], "purge")) {
+        sum = mode_purge(ps, n);
+    } else if (!strcmp(argv[1], "firsttouch")) {
+        sum = mode_firsttouch(ps, n);
+    } else {
+        fprintf(stderr, "unknown mode %s\n", argv[1]);
+        return 1;
+    }
+
+    free(buf);
+    printf("%lu\n", sum & 0xff);
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/*
+ * Benchmark workload: touches pages of a buffer in a pseudo-random order,
+ * interleaved with sequential sweeps. Random touches defeat the one-item
+ * cache of the tool, sweeps exercise it.
+ */
+
+int main(int argc, char**argv) {
+    long npages = 4096, ntouch = 2000000;
+    if (argc > 1) {
+        npages = atol(argv[1]);
+    }
+    if (argc > 2) {
+        ntouch = atol(argv[2]);
+    }
+    if (npages < 1) npages = 1;
+    if (ntouch < 0) ntouch = -ntouch;
+
+    const long ps = sysconf(_SC_PAGESIZE);
+    char *buf = malloc(npages * ps);
+    if (!buf) return 1;
+
+    unsigned long x = 42;
+    unsigned long sum = 0;
+    for (long i = 0; i < ntouch; ++i) {
+        x = x * 6364136223846793005UL + 1442695040888963407UL;  // LCG
+        const long p = (long) ((x >> 33) % npages);
+        buf[p * ps + (i & (ps - 1))] += 1;
+        if ((i & 0xffff) == 0) {
+            for (long s = 0; s < npages * ps; s += 64) sum += buf[s];
+        }
+    }
+
+    free(buf);
+    printf("%lu\n", sum);
+    return 0;
+}
@@ -0,0 +1,173 @@
+#!/usr/bin/python
+"""
+Performance regression gate.
+
+Runs each workload under --tool=none and --tool=ws, and compares slowdown
+factor, tool memory and fini time against a recorded baseline. The slowdown
+is timed without --ws-self-stats, since counting costs time in the hot path;
+memory and fini time come from one more run with it. Exits non-zero if any
+metric got worse than its tolerance allows. Without a baseline, the gate is
+skipped.
+"""
+import os
+import re
+import sys
+import json
+import time
+import argparse
+import subprocess
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from lib import testbase
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# name, command (relative to this directory), extra ws options
+WORKLOADS = [
+    dict(name='pageramp', cmd=['../pageramp/pageramp', '1024', '10'], opts=[]),
+    dict(name='pageramp-stride', cmd=['../pageramp/pageramp', '1024', '10', '8'], opts=[]),
+    dict(name='memwalk', cmd=['memwalk', '4096', '2000000'], opts=[]),
+    dict(name='memwalk-peaks', cmd=['memwalk', '4096', '2000000'], opts=['--ws-peak-detect=yes']),
+    dict(name='memwalk-insn', cmd=['memwalk', '4096', '2000000'], opts=['--ws-track=insn']),
+    dict(name='memwalk-data', cmd=['memwalk', '4096', '2000000'], opts=['--ws-track=data']),
+]
+
+# relative tolerance per metric
+TOLERANCES = dict(slowdown=0.10, memory_kb=0.10, fini_cycles=0.25)
+
+
+def build(exe):
+    """build workload with make's implicit rules, if not there"""
+    if not os.path.isfile(exe):
+        subprocess.call(['make', '-C', os.path.dirname(exe), os.path.basename(exe)])
+    return os.path.isfile(exe)
+
+
+def timed_run(args, repeat):
+    """run command repeatedly, return (min. wall time, output of last run)"""
+    best = None
+    out = ''
+    for _ in range(repeat):
+        t0 = time.time()
+        proc = subprocess.Popen(args, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                                universal_newlines=True)
+        out, _ = proc.communicate()
+        dt = time.time() - t0
+        if proc.returncode != 0:
+            raise RuntimeError("{} failed:\n{}".format(' '.join(args), out))
+        best = dt if best is None else min(best, dt)
+    return best, out
+
+
+def parse_self_stats(stdout):
+    """memory and fini time from the summary of --ws-self-stats"""
+    mem = None
+    fini = None
+    for line in stdout.split("\n"):
+        m = re.search(r"Tool memory:\s*(.*)$", line)
+        if m:
+            mem = sum(testbase.human_to_number(k) for k in re.findall(r"([\d,]+) kB", m.group(1)))
+        m = re.search(r"Fini cycles:.*total ([\d,]+)", line)
+        if m:
+            fini = testbase.human_to_number(m.group(1))
+    return mem, fini
+
+
+def measure(wl, repeat):
+    exe = os.path.join(HERE, wl['cmd'][0])
+    if not build(exe):
+        raise RuntimeError("Failed to build {}".format(exe))
+    cmd = [exe] + wl['cmd'][1:]
+    outfile = os.path.join(HERE, '{}.%p.log'.format(wl['name']))
+
+    ws = ['valgrind', '--tool=ws', '--ws-file={}'.format(outfile)] + wl['opts']
+    t_none, _ = timed_run(['valgrind', '--tool=none'] + cmd, repeat)
+    t_ws, out = timed_run(ws + cmd, repeat)
+    _, stats = timed_run(ws + ['--ws-self-stats=yes'] + cmd, 1)
+    for o in (out, stats):
+        fname = testbase.get_outfile(o.split("\n"))
+        if fname and os.path.isfile(fname):
+            os.remove(fname)
+    mem, fini = parse_self_stats(stats)
+    return dict(time_none=t_none, time_ws=t_ws, slowdown=t_ws / t_none,
+                memory_kb=mem, fini_cycles=fini)
+
+
+def compare(results, baseline, tolerances):
+    """print table, return list of regressions"""
+    regressions = []
+    print("{:20s} {:12s} {:>12s} {:>12s} {:>8s}".format('workload', 'metric', 'baseline',
+                                                       'current', 'change'))
+    for name, res in sorted(results.items()):
+        base = baseline.get(name)
+        if base is None:
+            print("{:20s} (not in baseline)".format(name))
+            continue
+        for metric, tol in sorted(tolerances.items()):
+            cur = res.get(metric)
+            ref = base.get(metric)
+            if cur is None or not ref:
+                continue
+            change = (cur - ref) / float(ref)
+            flag = ''
+            if change > tol:
+                flag = ' REGRESSION (>{:+.0%})'.format(tol)
+                regressions.append((name, metric))
+            print("{:20s} {:12s} {:12.2f} {:12.2f} {:+8.1%}{}".format(name, metric, ref, cur,
+                                                                    change, flag))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Performance regression gate for valgrind-ws')
+    parser.add_argument('-b', '--baseline', default=os.path.join(HERE, 'baseline.json'),
+                        help='baseline to compare against')
+    parser.add_argument('-o', '--output', default=os.path.join(HERE, 'results.json'),
+                        help='where to store the results')
+    parser.add_argument('-u', '--update', action='store_true', default=False,
+                        help='store results as new baseline instead of comparing')
+    parser.add_argument('-r', '--repeat', type=int, default=3,
+                        help='runs per workload, the fastest one counts')
+    parser.add_argument('-w', '--workload', action='append', default=None,
+                        help='run only this workload (repeatable)')
+    for metric, tol in sorted(TOLERANCES.items()):
+        parser.add_argument('--tol-{}'.format(metric.replace('_', '-')), type=float, default=tol,
+                            dest='tol_' + metric,
+                            help='relative tolerance for {} [{}]'.format(metric, tol))
+    args = parser.parse_args()
+
+    if not args.update and not os.path.isfile(args.baseline):
+        print("No baseline {}, skipping. Record one with 'make bench-baseline' on the reference "
+              "machine.".format(args.baseline))
+        return 0
+
+    results = {}
+    for wl in WORKLOADS:
+        if args.workload and wl['name'] not in args.workload:
+            continue
+        print("Benchmarking {} ...".format(wl['name']))
+        results[wl['name']] = measure(wl, args.repeat)
+
+    with open(args.output, 'w') as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+
+    if args.update:
+        with open(args.baseline, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+        print("Baseline written to {}".format(args.baseline))
+        return 0
+
+    with open(args.baseline, 'r') as f:
+        baseline = json.load(f)
+
+    tolerances = dict((m, getattr(args, 'tol_' + m)) for m in TOLERANCES)
+    regressions = compare(results, baseline, tolerances)
+    if regressions:
+        print("FAILED: {} regression(s)".format(len(regressions)))
+        return 1
+    print("PASSED")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,16 +1,24 @@
 import os
 import re
+import sys
 import subprocess
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'tools'))
+import wsreader
 
-def outfile(testname):
-    return os.path.splitext(os.path.basename(testname))[0] + '.%p.log'
 
+def outfile(testname, tag=None):
+    base = os.path.splitext(os.path.basename(testname))[0]
+    if tag:
+        base += '.' + tag
+    return base + '.%p.log'
 
-def run(desc, caller, args):
-    print desc,
+
+def run(desc, caller, args, tag=None):
+    if desc:
+        print desc,
     blob = subprocess.check_output(['valgrind', '--tool=ws', '--ws-file={}'.format
-                                   (outfile(caller))] + args, stderr=subprocess.STDOUT)
+                                   (outfile(caller, tag))] + args, stderr=subprocess.STDOUT)
     return blob.split("\n")
 
 
@@ -48,3 +56,21 @@ def analyze(stdout, func_check, keep=False):
         print "FAILED. See {}".format(fname)
         exit(1)
 
+
+
+def parse_samples(fname):
+    """list of (t, WSS_insn, WSS_data) from the working set table"""
+    with wsreader.WsReader(fname) as r:
+        return [(t, i, d) for t, i, d, _ in r.samples()]
+
+
+def parse_pages(fname):
+    """page lists (--ws-list-pages=yes) as [insn, data], each a dict page -> (count, last access)"""
+    with wsreader.WsReader(fname) as r:
+        return [dict((pg, (cnt, last)) for pg, (cnt, last, _) in lst.items()) for lst in r.pages()]
+
+
+def parse_summary(fname):
+    """statistics after the working set table, as dict of strings"""
+    with wsreader.WsReader(fname) as r:
+        return r.summary()
@@ -0,0 +1,88 @@
+"""
+Reference implementation of the working set semantics, for differential testing.
+
+Consumes an access trace written with --ws-trace-file, and recomputes what the
+tool must have reported. Deliberately simple and slow:
+ - every access counts for the page of its first byte,
+ - a page is in WS(t) if its last access happened strictly after t - tau,
+ - samples are taken exactly where the tool took them (sample records in the trace),
+ - a purge (--ws-madvise) drops data pages completely inside its range from the WS.
+"""
+import struct
+
+MAGIC = b'WSTRACE1'
+HEADER = struct.Struct('=QQQ')
+RECORD = struct.Struct('=QQQ')
+
+INSN = 0
+DATA = 1
+SAMPLE = 2
+PURGE = 3
+
+
+def read_trace(fname):
+    """generator over (time, address, kind, size); first item are the parameters"""
+    with open(fname, 'rb') as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError("{} is not a ws trace".format(fname))
+        pagesize, every, tau = HEADER.unpack(f.read(HEADER.size))
+        yield dict(pagesize=pagesize, every=every, tau=tau)
+        while True:
+            chunk = f.read(RECORD.size * 4096)
+            if not chunk:
+                break
+            for off in range(0, len(chunk) - RECORD.size + 1, RECORD.size):
+                t, addr, info = RECORD.unpack_from(chunk, off)
+                yield t, addr, info & 0xff, info >> 8
+
+
+def evaluate(fname):
+    """
+    Replay trace.
+
+    Returns dict with 'samples': list of (t, WSS_insn, WSS_data), and 'pages': for
+    INSN and DATA a dict page -> (count, last access).
+    """
+    trace = read_trace(fname)
+    params = next(trace)
+    mask = ~(params['pagesize'] - 1)
+    tau = params['tau']
+    pages = {INSN: {}, DATA: {}}
+    samples = []
+    for t, addr, kind, size in trace:
+        if kind == SAMPLE:
+            tmin = t - tau if tau < t else 0
+            samples.append((t,
+                            sum(1 for _, last in pages[INSN].values() if last > tmin),
+                            sum(1 for _, last in pages[DATA].values() if last > tmin)))
+        elif kind == PURGE:
+            for pg, (cnt, _) in pages[DATA].items():
+                if pg >= addr and pg + params['pagesize'] <= addr + size:
+                    pages[DATA][pg] = (cnt, 0)
+        else:
+            pg = addr & mask
+            cnt, _ = pages[kind].get(pg, (0, 0))
+            pages[kind][pg] = (cnt + 1, t)
+    return dict(params=params, samples=samples, pages=pages)
+
+
+def diff(ref, samples, pages=None, maxreport=5):
+    """compare tool output against reference, return list of differences"""
+    msgs = []
+    if len(ref['samples']) != len(samples):
+        msgs.append("number of samples: oracle {}, tool {}".format(len(ref['samples']),
+                                                                   len(samples)))
+    for exp, got in zip(ref['samples'], samples):
+        if exp != got:
+            msgs.append("sample: oracle (t, insn, data)={}, tool {}".format(exp, got))
+    if pages is not None:
+        for kind, name in ((INSN, 'insn'), (DATA, 'data')):
+            exp = ref['pages'][kind]
+            got = pages[kind]
+            for pg in sorted(set(exp) | set(got)):
+                if exp.get(pg) != got.get(pg):
+                    msgs.append("{} page {:#x}: oracle (count, last)={}, tool {}".format(
+                        name, pg, exp.get(pg), got.get(pg)))
+    if len(msgs) > maxreport:
+        msgs = msgs[:maxreport] + ["... and {} more".format(len(msgs) - maxreport)]
+    return msgs
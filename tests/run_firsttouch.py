@@ -0,0 +1,73 @@
+#!/usr/bin/python
+import os
+import re
+from lib import testbase
+from subprocess import call
+import wsreader
+
+DESC = "Checking first touch reads and writes..."
+
+EXE = "accessgen/accessgen"
+N = 16
+
+# the kind of first touch must not depend on how the accesses are instrumented
+ENGINES = [
+    ('default', []),
+    ('tiered', ['--ws-tiered=2']),
+    ('bulk', ['--ws-bulk-ranges=yes']),
+]
+
+# accessgen firsttouch: page 4i is stored first, 4i+1 loaded first, 4i+2 memset, 4i+3 memcpy'd
+EXPECT = [True, False, True, False]
+
+
+def check_engine(engine, opts):
+    stdout = testbase.run('', __file__, ['--ws-first-touch=log'] + opts +
+                          [EXE, 'firsttouch', '1', str(N)], engine)
+    base = None
+    for line in stdout:
+        m = re.match(r"firsttouch (0x[0-9a-f]+)", line)
+        if m:
+            base = int(m.group(1), 16)
+    fname = testbase.get_outfile(stdout)
+    if base is None or fname is None:
+        print "\n{}: no output".format(engine)
+        return False
+
+    with wsreader.WsReader(fname) as r:
+        ps = r.header().get('Page size', 4096)
+        written = dict((page, w) for _, page, kind, w, _ in r.first_touch()
+                       if kind == wsreader.DATA)
+    errs = []
+    for i in range(4 * N):
+        page = base + i * ps
+        if page not in written:
+            errs.append("page {:#x} not logged".format(page))
+        elif written[page] != EXPECT[i % 4]:
+            errs.append("page {:#x} logged as {}".format(page, 'w' if written[page] else 'r'))
+    if errs:
+        print "\n{}:\n  {}".format(engine, "\n  ".join(errs[:10]))
+        return False
+    os.remove(fname)
+    return True
+
+
+if not os.path.isfile(EXE):
+    opwd = os.getcwd()
+    os.chdir(os.path.dirname(EXE))
+    call(['make', os.path.basename(EXE)])
+    os.chdir(opwd)
+
+if not os.path.isfile(EXE):
+    print "{}: Failed to locate executable".format(__file__)
+    exit(1)
+
+print DESC,
+ok = True
+for engine, opts in ENGINES:
+    ok = check_engine(engine, opts) and ok
+if ok:
+    print "PASSED"
+    exit(0)
+print "FAILED"
+exit(1)
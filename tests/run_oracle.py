@@ -0,0 +1,81 @@
+#!/usr/bin/python
+import os
+from lib import testbase
+from lib import wsoracle
+from subprocess import call
+
+DESC = "Checking WSS against reference oracle..."
+
+PAGERAMP = "pageramp/pageramp"
+ACCESSGEN = "accessgen/accessgen"
+
+# name, ws options, workload. Odd and prime intervals, tau<every, tau>every.
+CASES = [
+    ('pageramp', [], [PAGERAMP, '64', '2']),
+    ('random', ['--ws-every=97', '--ws-tau=1009'], [ACCESSGEN, 'random', '1', '20000']),
+    ('random-8k', ['--ws-pagesize=8192', '--ws-every=1000', '--ws-tau=333'],
+     [ACCESSGEN, 'random', '2', '20000']),
+    ('codedata', ['--ws-every=501', '--ws-tau=501'], [ACCESSGEN, 'codedata', '3', '20000']),
+    ('codedata-insn', ['--ws-track=insn'], [ACCESSGEN, 'codedata', '3', '20000']),
+    ('codedata-data', ['--ws-track=data'], [ACCESSGEN, 'codedata', '3', '20000']),
+    ('boundary', ['--ws-every=211'], [ACCESSGEN, 'boundary', '4', '20000']),
+    ('burst', ['--ws-every=1000', '--ws-tau=5000'], [ACCESSGEN, 'burst', '5', '200']),
+    ('purge', ['--ws-madvise=yes', '--ws-every=997'], [ACCESSGEN, 'purge', '6', '20000']),
+]
+
+# each engine must produce identical results on all cases. Engines which cannot
+# record a trace (no access hooks) are compared with the reference of the first one.
+ENGINES = [
+    ('default', [], True),
+    ('tiered', ['--ws-tiered=2'], False),
+]
+
+
+def build(exe):
+    if not os.path.isfile(exe):
+        opwd = os.getcwd()
+        os.chdir(os.path.dirname(exe))
+        call(['make', os.path.basename(exe)])
+        os.chdir(opwd)
+    return os.path.isfile(exe)
+
+
+def check_case(engine, eopts, traced, case, copts, cmd, refs):
+    tag = '{}.{}'.format(engine, case)
+    trace = 'run_oracle.{}.%p.trace'.format(tag)
+    topts = ['--ws-trace-file=' + trace] if traced else []
+    stdout = testbase.run('', __file__, ['--ws-list-pages=yes'] + topts + eopts + copts + cmd, tag)
+    fname = testbase.get_outfile(stdout)
+    tname = fname.replace('.log', '.trace')
+    if traced:
+        refs[case] = wsoracle.evaluate(tname)
+    ref = refs.get(case)
+    if ref is None:
+        print "\n{} on {}: no reference".format(engine, case)
+        return False
+    msgs = wsoracle.diff(ref, testbase.parse_samples(fname), testbase.parse_pages(fname))
+    if msgs:
+        print "\n{} on {}:\n  {}".format(engine, case, "\n  ".join(msgs))
+        return False
+    os.remove(fname)
+    if traced:
+        os.remove(tname)
+    return True
+
+
+for exe in (PAGERAMP, ACCESSGEN):
+    if not build(exe):
+        print "{}: Failed to build {}".format(__file__, exe)
+        exit(1)
+
+print DESC,
+ok = True
+refs = {}
+for engine, eopts, traced in ENGINES:
+    for case, copts, cmd in CASES:
+        ok = check_case(engine, eopts, traced, case, copts, cmd, refs) and ok
+if ok:
+    print "PASSED"
+    exit(0)
+print "FAILED"
+exit(1)
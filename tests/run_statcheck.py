@@ -25,20 +25,19 @@ def check_result(fname):
     avg = None
     var = None
     npg = None
-    with open(fname, 'r') as f:
-        for line in f:
-            m = re.search(r"Data WSS avg/var/peak:[\s\t]*([\d\.,]+)/([\d\.,]+)/([\d\.,]+).*", line)
-            if m:
-                avg = testbase.human_to_number(m.group(1))
-                var = testbase.human_to_number(m.group(2))
-                pk = testbase.human_to_number(m.group(3))
-                ok_davg = 0.5*MAXPAGES <= avg <= 0.7*MAXPAGES
-                ok_dpk  = MAXPAGES <= pk <= 1.1*MAXPAGES
-                ok_dvar = 0.2*MAXPAGES <= math.sqrt(var) <= 0.3*MAXPAGES
-            m = re.search(r"Data pages/access:[\s\t]*([\d\.,]+) pages.*", line)
-            if m:
-                npg = testbase.human_to_number(m.group(1))
-                ok_dtot = MAXPAGES <= npg <= 1.1*MAXPAGES
+    summary = testbase.parse_summary(fname)
+    m = re.match(r"([\d\.,]+)/([\d\.,]+)/([\d\.,]+).*", summary.get('Data WSS avg/var/peak', ''))
+    if m:
+        avg = testbase.human_to_number(m.group(1))
+        var = testbase.human_to_number(m.group(2))
+        pk = testbase.human_to_number(m.group(3))
+        ok_davg = 0.5*MAXPAGES <= avg <= 0.7*MAXPAGES
+        ok_dpk  = MAXPAGES <= pk <= 1.1*MAXPAGES
+        ok_dvar = 0.2*MAXPAGES <= math.sqrt(var) <= 0.3*MAXPAGES
+    m = re.match(r"([\d\.,]+) pages.*", summary.get('Data pages/access', ''))
+    if m:
+        npg = testbase.human_to_number(m.group(1))
+        ok_dtot = MAXPAGES <= npg <= 1.1*MAXPAGES
     ok_rel = npg >= avg
     if ok_dtot and ok_davg and ok_dpk and ok_rel and ok_dvar:
         return True
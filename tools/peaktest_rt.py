@@ -5,8 +5,8 @@ import sys
 import collections
 import numpy as np
 import pylab
-import re
 import math
+import wsreader
 
 
 lag = 30  # moving window length
@@ -126,14 +126,8 @@ def peak_detect(y):
 
 if len(sys.argv) > 1:
     datafile = sys.argv[1]
-    stream = []
-    with open(datafile, 'r') as f:
-        for line in f:
-            parts = re.findall(r"[^\s\t]+", line)
-            if len(parts) > 2:
-                stream.append(int(parts[2]))  # 2=insn, 3=data
-
-    stream = np.array(stream)
+    with wsreader.WsReader(datafile) as r:
+        stream = r.samples_array()['wssd']  # or 'wssi' for insn
 else:
     # data stream
     stream = np.array(
@@ -0,0 +1,231 @@
+#!/usr/bin/python
+"""
+Accuracy versus overhead of approximate configurations.
+
+Runs a workload once with the reference (exact) options, then once per
+configuration. Compares the working set size of each configuration against
+the reference, and reports error, peak recall, slowdown and memory. The
+configurations which are not dominated by others are marked as Pareto-optimal.
+
+Example:
+  ./valgrind-ws-accuracy.py -c every50k:--ws-every=50000 \\
+                            -c pg8k:--ws-pagesize=8192 -- ./myprog arg1
+"""
+import os
+import re
+import sys
+import json
+import time
+import argparse
+import logging
+import subprocess
+import wsreader
+
+
+log = logging.getLogger(__name__)
+
+
+def parse_wss(fname):
+    """
+    return list of (t, wss_insn, wss_data) from the working set table, in kB, such that
+    runs with different --ws-pagesize can be compared
+    """
+    with wsreader.WsReader(fname) as r:
+        kb = r.header().get('Page size', 4096) / 1024.
+        return [(t, i * kb, d * kb) for t, i, d, _ in r.samples()]
+
+
+def parse_tool_memory(stdout):
+    """tool memory in kB, from the summary of --ws-self-stats"""
+    for line in stdout.split("\n"):
+        m = re.search(r"Tool memory:\s*(.*)$", line)
+        if m:
+            return sum(int(k.replace(',', '')) for k in re.findall(r"([\d,]+) kB", m.group(1)))
+    return None
+
+
+def get_outfile(stdout):
+    """output file of the main process (the one which started first)"""
+    m = re.search(r"==(\d+)==", stdout)
+    if not m:
+        return None
+    m = re.search(r"=={}== Writing results to file '(.*)'".format(m.group(1)), stdout)
+    return m.group(1) if m else None
+
+
+def run(valgrind, tool, opts, cmd, outfile=None):
+    """run under valgrind, return wall time, max. RSS in kB and output"""
+    args = [valgrind, '--tool={}'.format(tool)] + opts
+    if outfile:
+        args += ['--ws-file={}'.format(outfile)]
+    args += cmd
+    log.info("Running {}".format(' '.join(args)))
+    t0 = time.time()
+    proc = subprocess.Popen(args, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    out = proc.stdout.read()
+    _, status, rusage = os.wait4(proc.pid, 0)
+    dt = time.time() - t0
+    if status != 0:
+        raise RuntimeError("{} failed:\n{}".format(' '.join(args), out))
+    return dt, rusage.ru_maxrss, out
+
+
+def interpolate(samples, t):
+    """linear interpolation of total WSS at time t, samples sorted by time"""
+    lo = 0
+    hi = len(samples) - 1
+    if t <= samples[lo][0]:
+        return samples[lo][1] + samples[lo][2]
+    if t >= samples[hi][0]:
+        return samples[hi][1] + samples[hi][2]
+    while hi - lo > 1:
+        mid = (lo + hi) // 2
+        if samples[mid][0] <= t:
+            lo = mid
+        else:
+            hi = mid
+    t0, i0, d0 = samples[lo]
+    t1, i1, d1 = samples[hi]
+    w = (t - t0) / float(t1 - t0) if t1 > t0 else 0.
+    return (i0 + d0) + w * ((i1 + d1) - (i0 + d0))
+
+
+def find_peaks(samples, nsigma):
+    """local maxima of total WSS that exceed mean + nsigma standard deviations"""
+    tot = [i + d for _, i, d in samples]
+    if not tot:
+        return []
+    avg = sum(tot) / float(len(tot))
+    std = (sum((x - avg) ** 2 for x in tot) / float(len(tot))) ** 0.5
+    thresh = avg + nsigma * std
+    peaks = []
+    for k in range(len(tot)):
+        left = tot[k - 1] if k > 0 else -1
+        right = tot[k + 1] if k + 1 < len(tot) else -1
+        if tot[k] > thresh and tot[k] >= left and tot[k] >= right:
+            peaks.append((samples[k][0], tot[k]))
+    return peaks
+
+
+def accuracy(ref, approx, args):
+    """error metrics of approx against ref, in kB"""
+    errs = [abs((i + d) - interpolate(ref, t)) for t, i, d in approx]
+    mae = sum(errs) / float(len(errs)) if errs else float('nan')
+    maxerr = max(errs) if errs else float('nan')
+
+    # a reference peak is recalled if approx has a sample close by in time with similar height
+    peaks = find_peaks(ref, args.peak_sigma)
+    every = (ref[-1][0] - ref[0][0]) / float(max(len(ref) - 1, 1))
+    window = args.peak_window * every
+    recalled = 0
+    for tp, wp in peaks:
+        near = [i + d for t, i, d in approx if abs(t - tp) <= window]
+        if near and max(near) >= (1. - args.peak_tol) * wp:
+            recalled += 1
+    recall = recalled / float(len(peaks)) if peaks else 1.
+    return dict(mae=mae, max_err=maxerr, peak_recall=recall, peaks=len(peaks))
+
+
+def pareto(results):
+    """mark entries that are not dominated in (mae, slowdown, memory)"""
+    keys = ('mae', 'slowdown', 'rss_kb')
+    for r in results:
+        r['pareto'] = not any(all(o[k] <= r[k] for k in keys) and
+                              any(o[k] < r[k] for k in keys)
+                              for o in results if o is not r)
+
+
+def print_table(results):
+    print("{:16s} {:>10s} {:>10s} {:>7s} {:>9s} {:>10s} {:>10s} {:>7s}".format(
+        'config', 'MAE [kB]', 'max [kB]', 'recall', 'slowdown', 'RSS [MB]', 'tool [kB]', 'pareto'))
+    for r in results:
+        print("{:16s} {:10.2f} {:10.1f} {:7.0%} {:9.1f} {:10.1f} {:>10s} {:>7s}".format(
+            r['name'], r['mae'], r['max_err'], r['peak_recall'], r['slowdown'],
+            r['rss_kb'] / 1024., str(r['tool_kb']) if r['tool_kb'] is not None else '-',
+            '*' if r['pareto'] else ''))
+
+
+def plot(results, fname):
+    import matplotlib
+    matplotlib.use('Agg')
+    import matplotlib.pyplot as plt
+
+    fig = plt.figure(figsize=(8, 5))
+    ax = fig.add_subplot(111)
+    for r in results:
+        ax.scatter(r['slowdown'], r['mae'], color='r' if r['pareto'] else 'b')
+        ax.annotate(r['name'], xy=(r['slowdown'], r['mae']), xytext=(5, 5),
+                    textcoords='offset points')
+    front = sorted([r for r in results if r['pareto']], key=lambda r: r['slowdown'])
+    ax.plot([r['slowdown'] for r in front], [r['mae'] for r in front], 'r--')
+    ax.set_xlabel('slowdown vs. --tool=none')
+    ax.set_ylabel('mean absolute WSS error [kB]')
+    ax.set_title('Accuracy versus overhead')
+    ax.grid()
+    fig.savefig(fname, bbox_inches='tight')
+    log.info("Plot written to {}".format(fname))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Accuracy versus overhead of valgrind-ws options')
+    parser.add_argument('-c', '--config', action='append', default=[],
+                        help='configuration as <name>:<ws options>, repeatable')
+    parser.add_argument('-r', '--reference', default='',
+                        help='ws options of the exact reference run')
+    parser.add_argument('--valgrind', default='valgrind', help='valgrind executable')
+    parser.add_argument('--peak-sigma', type=float, default=2.,
+                        help='reference peaks are this many std. deviations above average')
+    parser.add_argument('--peak-window', type=float, default=2.,
+                        help='time window (in samples) in which a peak must be recalled')
+    parser.add_argument('--peak-tol', type=float, default=.1,
+                        help='relative height tolerance for recalled peaks')
+    parser.add_argument('-j', '--json', default=None, help='write results as JSON')
+    parser.add_argument('-o', '--outfile', default=None, help='write Pareto plot to file')
+    parser.add_argument('-k', '--keep', action='store_true', default=False,
+                        help='keep the ws output files')
+    parser.add_argument('cmd', nargs=argparse.REMAINDER, help='workload command')
+    args = parser.parse_args()
+    logging.basicConfig(level=logging.INFO, format=" %(levelname)s | %(message)s")
+
+    cmd = args.cmd[1:] if args.cmd and args.cmd[0] == '--' else args.cmd
+    if not cmd:
+        parser.error('no workload given')
+
+    configs = [('reference', args.reference.split())]
+    for c in args.config:
+        name, _, opts = c.partition(':')
+        configs.append((name, opts.split()))
+
+    t_none, _, _ = run(args.valgrind, 'none', [], cmd)
+
+    results = []
+    ref = None
+    for name, opts in configs:
+        dt, rss, out = run(args.valgrind, 'ws', ['--ws-self-stats=yes'] + opts, cmd,
+                           'ws.accuracy.{}.%p'.format(name))
+        outfile = get_outfile(out)
+        samples = parse_wss(outfile)
+        if ref is None:
+            ref = samples
+        r = dict(name=name, opts=' '.join(opts), slowdown=dt / t_none, rss_kb=rss,
+                 tool_kb=parse_tool_memory(out), samples=len(samples))
+        r.update(accuracy(ref, samples, args))
+        results.append(r)
+        if not args.keep:
+            for f in os.listdir('.'):
+                if f.startswith('ws.accuracy.{}.'.format(name)):
+                    os.remove(f)
+
+    pareto(results)
+    print_table(results)
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+    if args.outfile:
+        plot(results, args.outfile)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,228 @@
+#!/usr/bin/python
+"""
+Aggregate working sets of repeated runs of the same workload.
+
+Single runs vary with address space layout and thread scheduling. This script
+takes N outputs, maps each onto normalized time (0..1 of its own length), and
+reports the mean working set size with a confidence band, as well as the
+distribution of peaks and totals over all runs.
+
+If the outputs contain page lists (--ws-list-pages=yes), pages are normalized
+to offsets relative to the mapping they belong to (files by name, heap, stacks
+and anonymous mappings by kind and order), as listed by the tool, so that pages
+can be matched across runs. The script then reports how many pages were touched
+in all runs, and which ones only in some.
+
+Example:
+  for i in 1 2 3 4 5; do valgrind --tool=ws --ws-file=ws.run$i ./myprog; done
+  ./valgrind-ws-aggregate.py -o bands.png ws.run*
+"""
+import sys
+import json
+import math
+import argparse
+import logging
+import wsreader
+
+
+log = logging.getLogger(__name__)
+
+# two-sided 95% quantiles of Student's t distribution, by degrees of freedom
+T95 = [12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+       2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+       2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042]
+
+
+def t95(n):
+    """half width factor of the 95% confidence interval of a mean of n values"""
+    if n < 2:
+        return float('nan')
+    return T95[n - 2] if n - 2 < len(T95) else 1.960
+
+
+def mean_std(vals):
+    n = len(vals)
+    if n == 0:
+        return float('nan'), float('nan')
+    avg = sum(vals) / float(n)
+    std = math.sqrt(sum((v - avg) ** 2 for v in vals) / (n - 1)) if n > 1 else 0.
+    return avg, std
+
+
+def distribution(vals):
+    """dict with min, median, mean, std, max"""
+    s = sorted(vals)
+    n = len(s)
+    avg, std = mean_std(s)
+    med = (s[(n - 1) // 2] + s[n // 2]) / 2. if n else float('nan')
+    return dict(min=s[0] if s else None, median=med, mean=avg, std=std, max=s[-1] if s else None)
+
+
+def resample(samples, grid):
+    """WSS (insn, data) of samples at normalized times in grid, linear interpolation"""
+    t_end = float(samples[-1][0]) or 1.
+    ret = []
+    k = 0
+    for g in grid:
+        t = g * t_end
+        while k + 1 < len(samples) - 1 and samples[k + 1][0] < t:
+            k += 1
+        t0, i0, d0 = samples[k][:3]
+        t1, i1, d1 = samples[min(k + 1, len(samples) - 1)][:3]
+        w = min(max((t - t0) / float(t1 - t0), 0.), 1.) if t1 > t0 else 0.
+        ret.append((i0 + w * (i1 - i0), d0 + w * (d1 - d0)))
+    return ret
+
+
+def bands(runs, npoints):
+    """per grid point: mean and 95% confidence half width of insn, data and total WSS"""
+    grid = [p / float(npoints - 1) for p in range(npoints)]
+    series = [resample(r['samples'], grid) for r in runs]
+    ret = []
+    for k, g in enumerate(grid):
+        row = dict(progress=g)
+        for name, f in (('insn', lambda v: v[0]), ('data', lambda v: v[1]),
+                        ('total', lambda v: v[0] + v[1])):
+            vals = [f(s[k]) for s in series]
+            avg, std = mean_std(vals)
+            row[name] = avg
+            row[name + '_ci'] = t95(len(vals)) * std / math.sqrt(len(vals))
+        ret.append(row)
+    return ret
+
+
+def run_totals(run):
+    """peak WSS, total pages and length of one run"""
+    s = run['samples']
+    ret = dict(peak_insn=max(i for _, i, _, _ in s), peak_data=max(d for _, _, d, _ in s),
+               peak_total=max(i + d for _, i, d, _ in s), instructions=s[-1][0])
+    if any(run['pages']):
+        ret['pages_insn'] = len(run['pages'][wsreader.INSN])
+        ret['pages_data'] = len(run['pages'][wsreader.DATA])
+    return ret
+
+
+def normalized_pages(run, pagesize):
+    """set of (kind, mapping, offset in pages from the base of the mapping)"""
+    norm = wsreader.PageNormalizer(run['mappings'], pagesize)
+    ret = set()
+    for kind, name in ((wsreader.INSN, 'insn'), (wsreader.DATA, 'data')):
+        ret.update((name,) + norm(pg) for pg in run['pages'][kind])
+    return ret
+
+
+def page_stability(runs, pagesize, top):
+    """how many runs touched each normalized page"""
+    seen = {}
+    for r in runs:
+        for key in normalized_pages(r, pagesize):
+            seen[key] = seen.get(key, 0) + 1
+    n = len(runs)
+    ret = dict(all_runs=sum(1 for c in seen.values() if c == n),
+               some_runs=sum(1 for c in seen.values() if c < n))
+    per_map = {}
+    for (kind, mapping, _), c in seen.items():
+        e = per_map.setdefault((kind, mapping), [0, 0])
+        e[0 if c == n else 1] += 1
+    ret['mappings'] = sorted([dict(kind=k, mapping=m, stable=s, variable=v)
+                              for (k, m), (s, v) in per_map.items()],
+                             key=lambda e: -e['variable'])[:top]
+    return ret
+
+
+def print_result(res, rows):
+    print("Runs: {}".format(res['runs']))
+    print("\n{:>8s} {:>18s} {:>18s} {:>18s}".format('progress', 'insn', 'data', 'total'))
+    last = len(res['bands']) - 1
+    rows = min(max(rows, 2), last + 1)
+    for b in [res['bands'][int(round(k * last / float(rows - 1)))] for k in range(rows)]:
+        print("{:8.0%} {:10.1f} +-{:6.1f} {:10.1f} +-{:6.1f} {:10.1f} +-{:6.1f}".format(
+            b['progress'], b['insn'], b['insn_ci'], b['data'], b['data_ci'],
+            b['total'], b['total_ci']))
+    print("(mean +- 95% confidence interval, in pages)")
+    print("\n{:14s} {:>12s} {:>12s} {:>12s} {:>12s} {:>12s}".format(
+        '', 'min', 'median', 'mean', 'std', 'max'))
+    for k, d in sorted(res['totals'].items()):
+        print("{:14s} {:12.0f} {:12.1f} {:12.1f} {:12.1f} {:12.0f}".format(
+            k, d['min'], d['median'], d['mean'], d['std'], d['max']))
+    st = res.get('pages')
+    if st:
+        print("\nPages touched in all runs: {}, only in some: {}".format(st['all_runs'],
+                                                                       st['some_runs']))
+        for m in st['mappings']:
+            print("  {:4s} {:8d} stable {:8d} variable  {}".format(m['kind'], m['stable'],
+                                                                   m['variable'], m['mapping']))
+
+
+def plot(res, fname):
+    import matplotlib
+    matplotlib.use('Agg')
+    import matplotlib.pyplot as plt
+
+    fig = plt.figure(figsize=(10, 5))
+    ax = fig.add_subplot(111)
+    x = [b['progress'] for b in res['bands']]
+    for name, color in (('insn', 'r'), ('data', 'b'), ('total', 'k')):
+        y = [b[name] for b in res['bands']]
+        ci = [b[name + '_ci'] for b in res['bands']]
+        ax.plot(x, y, color=color, label=name)
+        ax.fill_between(x, [a - c for a, c in zip(y, ci)], [a + c for a, c in zip(y, ci)],
+                        color=color, alpha=.2)
+    ax.set_xlabel('normalized time')
+    ax.set_ylabel('working set size [pages]')
+    ax.set_title('Mean WSS and 95% confidence band of {} runs'.format(res['runs']))
+    ax.legend()
+    ax.grid()
+    fig.savefig(fname, bbox_inches='tight')
+    log.info("Plot written to {}".format(fname))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Aggregate repeated valgrind-ws outputs')
+    parser.add_argument('files', nargs='+', help='ws output files of the same workload')
+    parser.add_argument('-n', '--points', type=int, default=200,
+                        help='resolution of normalized time')
+    parser.add_argument('-r', '--rows', type=int, default=11, help='rows of the printed table')
+    parser.add_argument('--top', type=int, default=10, help='mappings to list')
+    parser.add_argument('-j', '--json', default=None, help='write results as JSON')
+    parser.add_argument('-o', '--outfile', default=None, help='write band plot to file')
+    args = parser.parse_args()
+    logging.basicConfig(level=logging.INFO, format=" %(levelname)s | %(message)s")
+
+    if len(args.files) < 2:
+        parser.error('need at least two runs')
+
+    runs = []
+    pagesize = None
+    for fname in args.files:
+        with wsreader.WsReader(fname) as r:
+            if not r.samples():
+                log.warning("{} has no working set table, skipped".format(fname))
+                continue
+            runs.append(dict(name=fname, samples=r.samples(), pages=r.pages(),
+                             mappings=r.mappings()))
+            if any(r.pages()) and not r.mappings():
+                log.warning("{} lists no mappings, its pages only match by address".format(fname))
+            pagesize = pagesize or r.header().get('Page size', 4096)
+    if len(runs) < 2:
+        log.error("Need at least two runs with working set tables")
+        return 1
+
+    res = dict(runs=len(runs), bands=bands(runs, max(args.points, 2)))
+    per_run = [run_totals(r) for r in runs]
+    res['totals'] = dict((k, distribution([p[k] for p in per_run if k in p]))
+                         for k in per_run[0])
+    if all(any(r['pages']) for r in runs):
+        res['pages'] = page_stability(runs, pagesize, args.top)
+
+    print_result(res, args.rows)
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(res, f, indent=2, sort_keys=True)
+    if args.outfile:
+        plot(res, args.outfile)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,316 @@
+#!/usr/bin/python
+"""
+Compare working sets of two or more runs.
+
+The first file is the baseline, every other file is compared against it. Runs
+are aligned on a common axis (instructions, normalized progress, or the sample
+info of peaks that both runs share), and split into phases. Per phase, the mean
+working set size is compared and tested for significance with a Mann-Whitney U
+test. Samples less than tau apart share part of their window and are strongly
+autocorrelated, so the test only uses one sample per tau of each run (the means
+use all samples). A phase with fewer than 3 such samples per run has no p-value,
+and cannot fail --max-increase; use fewer phases or a smaller tau. With page lists
+(--ws-list-pages=yes), also the pages per object, data pages per mapping, and newly
+hot pages and functions are reported. Pages are matched across runs by their offset
+in the mapping they belong to, not by address.
+
+Exits with 1 if a phase grew significantly more than --max-increase.
+
+Example:
+  ./valgrind-ws-compare.py --align=progress --max-increase=0.1 ws.release.out ws.new.out
+"""
+import sys
+import json
+import math
+import argparse
+import logging
+import wsreader
+
+
+log = logging.getLogger(__name__)
+
+def parse_output(fname):
+    """samples, sample info and page lists of one ws output file"""
+    with wsreader.WsReader(fname) as r:
+        run = dict(name=fname, samples=r.samples(), pages=r.pages(),
+                   tau=r.header().get('Tau', 0),
+                   sampleinfo=dict((k, v['loc']) for k, v in r.sample_info().items()),
+                   normalize=wsreader.PageNormalizer(r.mappings(),
+                                                     r.header().get('Page size', 4096)))
+        if any(run['pages']) and not r.mappings():
+            log.warning("{} lists no mappings, its pages only match by address".format(fname))
+    if not run['samples']:
+        raise ValueError("{} has no working set table".format(fname))
+    return run
+
+
+def labels(run):
+    """(time, location) of every sample with info, in order"""
+    return [(t, run['sampleinfo'].get(pk)) for t, _, _, pk in run['samples']
+            if pk is not None and run['sampleinfo'].get(pk)]
+
+
+def common_labels(a, b):
+    """longest common subsequence of locations, as pairs of times (t_a, t_b)"""
+    n, m = len(a), len(b)
+    tab = [[0] * (m + 1) for _ in range(n + 1)]
+    for i in range(n - 1, -1, -1):
+        for j in range(m - 1, -1, -1):
+            if a[i][1] == b[j][1]:
+                tab[i][j] = tab[i + 1][j + 1] + 1
+            else:
+                tab[i][j] = max(tab[i + 1][j], tab[i][j + 1])
+    pairs = []
+    i = j = 0
+    while i < n and j < m:
+        if a[i][1] == b[j][1]:
+            pairs.append((a[i][0], b[j][0]))
+            i += 1
+            j += 1
+        elif tab[i + 1][j] >= tab[i][j + 1]:
+            i += 1
+        else:
+            j += 1
+    return pairs
+
+
+def piecewise(x, xs, ys):
+    """linear interpolation through (xs, ys), extrapolated with the last slope"""
+    k = 1
+    while k < len(xs) - 1 and x > xs[k]:
+        k += 1
+    x0, x1, y0, y1 = xs[k - 1], xs[k], ys[k - 1], ys[k]
+    return y0 + (x - x0) * (y1 - y0) / float(x1 - x0) if x1 > x0 else y0
+
+
+def align(base, run, mode):
+    """set run['x'] to the sample times on the axis of the baseline"""
+    t_end = float(run['samples'][-1][0]) or 1.
+    tb_end = float(base['samples'][-1][0]) or 1.
+    if mode == 'label' and run is not base:
+        pairs = common_labels(labels(base), labels(run))
+        if pairs:
+            log.info("{}: aligned on {} common sample info labels".format(run['name'], len(pairs)))
+            anchors = sorted(set([(0, 0)] + pairs + [(tb_end, t_end)]), key=lambda p: p[1])
+            ys = [p[0] for p in anchors]
+            xs = [p[1] for p in anchors]
+            run['x'] = [piecewise(t, xs, ys) for t, _, _, _ in run['samples']]
+            return
+        log.warning("{}: no common sample info labels, aligning on progress".format(run['name']))
+        mode = 'progress'
+    if mode == 'time' or run is base:
+        run['x'] = [float(t) for t, _, _, _ in run['samples']]
+    else:
+        run['x'] = [t / t_end * tb_end for t, _, _, _ in run['samples']]
+
+
+def mann_whitney(a, b):
+    """two-sided p-value of Mann-Whitney U test (normal approximation, tie corrected)"""
+    n1, n2 = len(a), len(b)
+    if n1 < 3 or n2 < 3:
+        return float('nan')
+    vals = sorted([(v, 0) for v in a] + [(v, 1) for v in b])
+    ranks = [0.] * len(vals)
+    ties = 0.
+    i = 0
+    while i < len(vals):
+        j = i
+        while j + 1 < len(vals) and vals[j + 1][0] == vals[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[k] = (i + j) / 2. + 1
+        cnt = j - i + 1
+        ties += cnt ** 3 - cnt
+        i = j + 1
+    r1 = sum(r for r, (_, g) in zip(ranks, vals) if g == 0)
+    u = r1 - n1 * (n1 + 1) / 2.
+    n = n1 + n2
+    var = n1 * n2 / 12. * ((n + 1) - ties / (n * (n - 1)))
+    if var <= 0:
+        return 1.
+    z = (abs(u - n1 * n2 / 2.) - .5) / math.sqrt(var)
+    return math.erfc(max(z, 0.) / math.sqrt(2))
+
+
+def thin(samples, tau):
+    """values of (t, value) samples, keeping one per tau, such that they do not overlap"""
+    ret = []
+    last = None
+    for t, v in samples:
+        if last is None or t - last >= tau:
+            ret.append(v)
+            last = t
+    return ret
+
+
+def phase_stats(base, run, nphases):
+    """per phase: mean WSS of both runs, relative change and p-value"""
+    end = base['x'][-1] or 1.
+    ret = []
+    for p in range(nphases):
+        lo = end * p / nphases
+        hi = end * (p + 1) / nphases
+        last = p == nphases - 1
+
+        def select(r):
+            return [(t, i + d) for x, (t, i, d, _) in zip(r['x'], r['samples'])
+                    if lo <= x < hi or (last and x >= hi)]
+        a = [v for _, v in select(base)]
+        b = [v for _, v in select(run)]
+        ma = sum(a) / float(len(a)) if a else float('nan')
+        mb = sum(b) / float(len(b)) if b else float('nan')
+        rel = (mb - ma) / ma if a and b and ma > 0 else float('nan')
+        ta = thin(select(base), base['tau'])
+        tb = thin(select(run), run['tau'])
+        ret.append(dict(phase=p, start=lo, end=hi, base=ma, new=mb, change=rel,
+                        tested=(len(ta), len(tb)), p_value=mann_whitney(ta, tb)))
+    return ret
+
+
+def group_pages(run):
+    """number of pages per object (code) and data pages per mapping"""
+    objs = {}
+    funcs = {}
+    for count, _, loc in run['pages'][0].values():
+        fn, obj = wsreader.location_parts(loc)
+        obj = obj or '???'
+        objs[obj] = objs.get(obj, 0) + 1
+        if fn:
+            funcs[fn] = funcs.get(fn, 0) + count
+    regions = {}
+    for pg in run['pages'][1]:
+        mapping, _ = run['normalize'](pg)
+        regions[mapping] = regions.get(mapping, 0) + 1
+    return objs, regions, funcs
+
+
+def diff_groups(a, b):
+    """entries that differ, sorted by absolute change"""
+    ret = [(k, a.get(k, 0), b.get(k, 0)) for k in set(a) | set(b) if a.get(k, 0) != b.get(k, 0)]
+    return sorted(ret, key=lambda e: -abs(e[2] - e[1]))
+
+
+def new_hot(base, run, top):
+    """
+    pages and functions of run which are not in base, sorted by accesses; pages as
+    (kind, mapping, offset, count)
+    """
+    pages = []
+    for kind in (0, 1):
+        known = set(base['normalize'](pg) for pg in base['pages'][kind])
+        for pg, (count, _, _) in run['pages'][kind].items():
+            mapping, offset = run['normalize'](pg)
+            if (mapping, offset) not in known:
+                pages.append(('insn' if kind == 0 else 'data', mapping, offset, count))
+    pages.sort(key=lambda e: -e[3])
+    _, _, fa = group_pages(base)
+    _, _, fb = group_pages(run)
+    funcs = sorted([(fn, c) for fn, c in fb.items() if fn not in fa], key=lambda e: -e[1])
+    return pages[:top], funcs[:top]
+
+
+def compare(base, run, args):
+    res = dict(base=base['name'], new=run['name'],
+               phases=phase_stats(base, run, args.phases))
+    if any(base['pages']) and any(run['pages']):
+        oa, ra, _ = group_pages(base)
+        ob, rb, _ = group_pages(run)
+        res['objects'] = diff_groups(oa, ob)[:args.top]
+        res['regions'] = diff_groups(ra, rb)[:args.top]
+        res['new_pages'], res['new_functions'] = new_hot(base, run, args.top)
+    res['regressions'] = [p['phase'] for p in res['phases']
+                          if args.max_increase is not None and p['change'] > args.max_increase
+                          and p['p_value'] < args.alpha]
+    return res
+
+
+def print_result(res):
+    print("{} vs. {}".format(res['new'], res['base']))
+    print("{:>5s} {:>14s} {:>14s} {:>10s} {:>10s} {:>8s} {:>8s}".format(
+        'phase', 'start', 'end', 'base', 'new', 'change', 'p'))
+    for p in res['phases']:
+        flag = ' *' if p['phase'] in res['regressions'] else ''
+        print("{:5d} {:14.0f} {:14.0f} {:10.1f} {:10.1f} {:+8.1%} {:8.3f}{}".format(
+            p['phase'], p['start'], p['end'], p['base'], p['new'], p['change'], p['p_value'],
+            flag))
+    for key, title in (('objects', 'Code pages per object'),
+                       ('regions', 'Data pages per mapping')):
+        if res.get(key):
+            print("\n{}:".format(title))
+            for name, a, b in res[key]:
+                print("  {:8d} -> {:8d}  {}".format(a, b, name))
+    if res.get('new_pages'):
+        print("\nNew hot pages:")
+        for kind, mapping, offset, count in res['new_pages']:
+            print("  {} {:10d} {}{:+d}".format(kind, count, mapping, offset))
+    if res.get('new_functions'):
+        print("\nNew hot functions:")
+        for fn, count in res['new_functions']:
+            print("  {:10d} {}".format(count, fn))
+    print("")
+
+
+def plot(runs, nphases, fname):
+    import matplotlib
+    matplotlib.use('Agg')
+    import matplotlib.pyplot as plt
+
+    fig = plt.figure(figsize=(10, 5))
+    ax = fig.add_subplot(111)
+    for r in runs:
+        ax.plot(r['x'], [i + d for _, i, d, _ in r['samples']], label=r['name'])
+    end = runs[0]['x'][-1]
+    for p in range(1, nphases):
+        ax.axvline(end * p / nphases, color='grey', linestyle=':')
+    ax.set_xlabel('aligned time (baseline instructions)')
+    ax.set_ylabel('WSS insn+data [pages]')
+    ax.legend()
+    ax.grid()
+    fig.savefig(fname, bbox_inches='tight')
+    log.info("Plot written to {}".format(fname))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare working sets of valgrind-ws outputs')
+    parser.add_argument('files', nargs='+', help='ws output files, the first is the baseline')
+    parser.add_argument('-a', '--align', default='time', choices=['time', 'progress', 'label'],
+                        help='align on instructions, normalized progress, or common sample info')
+    parser.add_argument('-p', '--phases', type=int, default=10, help='number of phases')
+    parser.add_argument('--max-increase', type=float, default=None,
+                        help='fail if the mean WSS of a phase grew by more than this fraction')
+    parser.add_argument('--alpha', type=float, default=0.05,
+                        help='significance level for --max-increase')
+    parser.add_argument('--top', type=int, default=10, help='entries per list')
+    parser.add_argument('-j', '--json', default=None, help='write results as JSON')
+    parser.add_argument('-o', '--outfile', default=None, help='write overlay plot to file')
+    args = parser.parse_args()
+    logging.basicConfig(level=logging.INFO, format=" %(levelname)s | %(message)s")
+
+    if len(args.files) < 2:
+        parser.error('need a baseline and at least one file to compare')
+
+    runs = [parse_output(f) for f in args.files]
+    for r in runs:
+        align(runs[0], r, args.align)
+
+    results = []
+    for r in runs[1:]:
+        res = compare(runs[0], r, args)
+        print_result(res)
+        results.append(res)
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+    if args.outfile:
+        plot(runs, args.phases, args.outfile)
+
+    failed = sum(len(r['regressions']) for r in results)
+    if failed:
+        print("FAILED: {} phase(s) grew by more than {:.0%}".format(failed, args.max_increase))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,180 @@
+#!/usr/bin/python
+"""
+Merge the outputs of measurement windows (--ws-start-at/--ws-stop-after) into one.
+
+A long run can be measured in slices on several machines in parallel, e.g. with
+slices of length L:
+  valgrind --tool=ws --ws-start-at=$((k*L)) --ws-stop-after=$L --ws-file=ws.slice$k ./myprog
+
+Each slice starts with an empty page table, so its samples within tau after the
+start miss the pages which were accessed before the window opened. The tool
+prints the last access of pages still in the working set at the window end, and
+the first access of pages touched within tau after the start ("Window state").
+With these, samples at the seam are corrected: a page of the previous window's
+tail is added to the working set at time t, if its last access was after t - tau
+and it was not touched again in the new window until t.
+
+This is exact for back-to-back windows, provided that the program is
+deterministic (same instruction count, same addresses; disable ASLR). It is
+approximate where
+ * windows have a gap: accesses in the gap are missing. Windows open at a thread
+   switch, i.e., up to one time slice after the requested start,
+ * windows overlap by less than tau: the earlier window is used up to its end,
+   and pages touched by both windows may be counted too often at the seam.
+Windows which overlap by at least tau are merged without correction.
+
+Example:
+  ./valgrind-ws-merge.py -o ws.merged ws.slice*
+"""
+import sys
+import argparse
+import logging
+import wsreader
+
+
+log = logging.getLogger(__name__)
+
+
+def load(fname):
+    with wsreader.WsReader(fname) as r:
+        win = r.window_state()
+        if not r.has('Window state'):
+            log.warning("{} has no window state, treated as whole run".format(fname))
+            win = dict(start=0, stop=None, head={}, tail={})
+        return dict(name=fname, header=r.header(), samples=r.samples(), pages=r.pages(),
+                    start=win['start'], stop=win['stop'], head=win['head'], tail=win['tail'])
+
+
+def seam_pages(prev, cur, t, tau):
+    """pages of prev's tail still in the working set at t, but not yet seen by cur"""
+    ret = [0, 0]
+    for (kind, pg), last in prev['tail'].items():
+        if last <= t - tau:
+            continue
+        first = cur['head'].get((kind, pg))
+        if first is not None and first <= t:
+            continue
+        ret[kind] += 1
+    return ret
+
+
+def merge_samples(slices, tau):
+    """one series of (t, WSS_insn, WSS_data, corrected), and a report per seam"""
+    merged = []
+    seams = []
+    prev = None
+    for s in slices:
+        t_end = merged[-1][0] if merged else -1
+        seam = dict(window=s['name'], start=s['start'], gap=0, overlap=0, corrected=0)
+        if prev is not None:
+            if prev['stop'] is None:
+                log.warning("{} ends before {} starts, but has no stop".format(
+                    prev['name'], s['name']))
+            else:
+                seam['gap'] = max(s['start'] - prev['stop'], 0)
+                seam['overlap'] = max(prev['stop'] - s['start'], 0)
+            if seam['gap'] > 0:
+                log.warning("{} instructions not measured before {}".format(seam['gap'],
+                                                                            s['name']))
+        exact_from = s['start'] + tau
+        for t, wi, wd, _ in s['samples']:
+            if t <= t_end:
+                continue  # previous window is more accurate here
+            corr = False
+            if prev is not None and t < exact_from and seam['overlap'] < tau:
+                add = seam_pages(prev, s, t, tau)
+                wi += add[wsreader.INSN]
+                wd += add[wsreader.DATA]
+                corr = True
+                seam['corrected'] += 1
+            merged.append((t, wi, wd, corr))
+        seams.append(seam)
+        prev = s
+    return merged, seams
+
+
+def merge_pages(slices):
+    """union of page lists: counts are added, last access is the latest"""
+    ret = [{}, {}]
+    for s in slices:
+        for kind in (wsreader.INSN, wsreader.DATA):
+            for pg, (cnt, last, loc) in s['pages'][kind].items():
+                c0, l0, loc0 = ret[kind].get(pg, (0, 0, ''))
+                ret[kind][pg] = (c0 + cnt, max(l0, last), loc0 or loc)
+    return ret
+
+
+def write_pages(f, pages):
+    f.write("{:,} entries:\n".format(len(pages)))
+    f.write("{:>8s} {:>20s} {:>14s} location".format('count', 'page', 'last-accessed'))
+    for pg, (cnt, last, loc) in sorted(pages.items(), key=lambda e: -e[1][0]):
+        f.write("\n{:8d} {:#018x} {:14d} {}".format(cnt, pg, last, loc).rstrip())
+    f.write("\n")
+
+
+def write_merged(fname, slices, merged, seams, pages):
+    hdr = slices[0]['header']
+    with open(fname, 'w') as f:
+        f.write("Working Set Measurement merged by valgrind-ws-merge.py\n\n")
+        f.write("Command:        {}\n".format(hdr.get('Command', '')))
+        f.write("Instructions:   {:,}\n".format(merged[-1][0] if merged else 0))
+        f.write("Page size:      {} B\n".format(hdr.get('Page size')))
+        f.write("Time Unit:      {}\n".format(hdr.get('Time Unit')))
+        f.write("Every:          {:,} units\n".format(hdr.get('Every')))
+        f.write("Tau:            {:,} units\n\n".format(hdr.get('Tau')))
+        f.write("--\n\n")
+        if pages:
+            f.write("Code pages, ")
+            write_pages(f, pages[wsreader.INSN])
+            f.write("\nData pages, ")
+            write_pages(f, pages[wsreader.DATA])
+            f.write("\n--\n\n")
+        f.write("Working sets:\n")
+        f.write("{:>12s} {:>8s} {:>8s} {:>4s}\n".format('t', 'WSS_insn', 'WSS_data', 'seam'))
+        for t, wi, wd, corr in merged:
+            f.write("{:12d} {:8d} {:8d} {:4d}\n".format(t, wi, wd, 1 if corr else 0))
+        f.write("\n--\n\n")
+        f.write("Window seams:\n")
+        f.write("{:>14s} {:>12s} {:>12s} {:>9s} window".format('start', 'gap', 'overlap',
+                                                              'corrected'))
+        for s in seams:
+            f.write("\n{:14d} {:12d} {:12d} {:9d} {}".format(s['start'], s['gap'], s['overlap'],
+                                                          s['corrected'], s['window']))
+        f.write("\n--\n\n")
+    log.info("Merged output written to {}".format(fname))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Merge valgrind-ws outputs of measurement windows')
+    parser.add_argument('files', nargs='+', help='ws output files, one per window')
+    parser.add_argument('-o', '--outfile', default='ws.merged', help='merged output file')
+    args = parser.parse_args()
+    logging.basicConfig(level=logging.INFO, format=" %(levelname)s | %(message)s")
+
+    slices = []
+    for fname in args.files:
+        s = load(fname)
+        if s['start'] is None:
+            log.warning("{}: window never opened, skipped".format(fname))
+            continue
+        slices.append(s)
+    if not slices:
+        log.error("No windows to merge")
+        return 1
+    slices.sort(key=lambda s: s['start'])
+
+    for key in ('Page size', 'Every', 'Tau'):
+        vals = set(s['header'].get(key) for s in slices)
+        if len(vals) > 1:
+            log.error("Windows differ in '{}': {}".format(key, sorted(vals)))
+            return 1
+    tau = slices[0]['header']['Tau']
+
+    merged, seams = merge_samples(slices, tau)
+    pages = merge_pages(slices) if all(any(s['pages']) for s in slices) else None
+    write_merged(args.outfile, slices, merged, seams, pages)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -5,9 +5,12 @@ import sys
 import argparse
 import logging
 import coloredlogs
-import re
+import json
 import numpy as np
 import matplotlib.pyplot as plt
+import wsreader
+
+CACHE_VERSION = 1
 
 
 level = logging.INFO
@@ -19,14 +22,44 @@ coloredlogs.install(level=level, fmt=fmt)
 log = logging.getLogger(__name__)
 
 
+def lttb(x, y, n_out, keep=None):
+    """
+    Largest-Triangle-Three-Buckets downsampling.
+
+    Returns sorted indices of at most n_out points (plus those in keep) that
+    preserve the visual shape of (x, y), including its extremes.
+    """
+    n = len(x)
+    if n_out >= n or n_out < 3:
+        idx = np.arange(n)
+    else:
+        idx = np.zeros(n_out, dtype=np.int64)
+        edges = np.linspace(1, n - 1, n_out - 1).astype(np.int64)
+        a = 0
+        for i in range(n_out - 2):
+            lo, hi = edges[i], edges[i + 1]
+            # average of next bucket is the third corner
+            nlo, nhi = hi, edges[i + 2] if i + 2 < len(edges) else n
+            cx = x[nlo:nhi].mean()
+            cy = y[nlo:nhi].mean()
+            area = np.abs((x[a] - cx) * (y[lo:hi] - y[a]) - (x[a] - x[lo:hi]) * (cy - y[a]))
+            a = lo + int(np.argmax(area))
+            idx[i + 1] = a
+        idx[-1] = n - 1
+    extra = [np.argmax(y), np.argmin(y)]
+    if keep is not None:
+        extra = np.concatenate([extra, keep])
+    return np.union1d(idx, np.asarray(extra, dtype=np.int64))
+
+
 def plot_all(stats, info, args):
-    # stats: [data]
-    # data: {t=, wssd=, wssi=}
+    # stats: dict of arrays t, wssi, wssd, info (-1 = none)
 
-    ind = [d['t'] for d in stats]
-    wssi = [d['wssi'] for d in stats]
-    wssd = [d['wssd'] for d in stats]
-    peaks = {d['t']: d['info'] for d in stats if d['info'] is not None}
+    ind = stats['t']
+    wssi = stats['wssi']
+    wssd = stats['wssd']
+    has_info = stats['info'] >= 0
+    peaks = dict(zip(ind[has_info], stats['info'][has_info]))
 
     if args.figsize is not None:
         parts = args.figsize.split(",")
@@ -34,16 +67,24 @@ def plot_all(stats, info, args):
     else:
         figsize = (10, 5)
     fig = plt.figure(figsize=figsize)
-    ax = fig.add_subplot('111')
+    ax = fig.add_subplot(111)
     mid = ind[0] + (ind[-1] - ind[0]) / 2
 
-    ax.plot(ind, wssi, color='r', linestyle='-.')
+    # no point in drawing more than two points per pixel
+    n_max = args.max_points or int(2 * figsize[0] * fig.dpi)
+    keep = np.nonzero(has_info)[0]
+    sel_i = lttb(ind, wssi, n_max, keep)
+    sel_d = lttb(ind, wssd, n_max, keep)
+    if len(sel_d) < len(ind):
+        log.info("Downsampled {} to {} points".format(len(ind), max(len(sel_i), len(sel_d))))
+
+    ax.plot(ind[sel_i], wssi[sel_i], color='r', linestyle='-.')
     leg = ['insn']
     avgi = np.average(wssi)
     ax.plot([ind[0], mid, ind[-1]], [avgi] * 3, color='k', marker='x', linestyle='--')
     leg += ['insn-avg']
 
-    ax.plot(ind, wssd, color='b')
+    ax.plot(ind[sel_d], wssd[sel_d], color='b')
     leg += ['data']
     avgd = np.average(wssd)
     ax.plot([ind[0], mid, ind[-1]], [avgd] * 3, color='k', marker='o', linestyle='--')
@@ -59,7 +100,7 @@ def plot_all(stats, info, args):
 
     # annotate sample info
     info_color = 'green'
-    for t, pkid in peaks.iteritems():
+    for t, pkid in peaks.items():
         plt.axvline(x=t, color=info_color, linestyle='dotted')
         ax.annotate('{}'.format(pkid),
                     xy=(t, 0), xycoords='data',
@@ -87,93 +128,81 @@ def plot_all(stats, info, args):
 
 
 def parse_file(fname, with_info):
-
-    def human_number_to_int(st):
-        try:
-            num = int(st.replace(',', ''))
-        except ValueError:
-            num = None
-        return num
-
-    ret = []
-    info = {}
+    """
+    Returns dict of arrays (t, wssi, wssd, info), and dict with preamble and sample info.
+    """
     if not os.path.isfile(fname):
         log.error("File {} does not exist".format(fname))
-        return None
-
-    l = 0
-    hdr = True
-    state = 'preamble'
-    with open(fname, 'r') as f:
-        for line in f:
-            l += 1
-
-            if '--' == line.strip():
-                state = 'search'
-                log.debug("section end")
-                continue
-
-            if state == 'search':
-                if re.match(r"^Working sets:", line):
-                    state = "wset"
-                    hdr = True
-                    log.info("Found WS data in line {}".format(l))
-                    continue
-
-                if re.match(r"Sample info", line):
-                    state = "sampleinfo"
-                    log.info("Found sample info in line {}".format(l))
-                    continue
-
-            if state == "preamble":
-                m = re.match(r"([^:]+):[\s\t]*(.*)$", line)
-                if m:
-                    k = m.group(1)
-                    v = m.group(2)
-                    if k in ('Tau', 'Every', 'Instructions', 'Page size', 'Peak window'):
-                        v = human_number_to_int(v.split(' ')[0])
-                    info[k] = v
-                    log.debug("Preamble: {}={}".format(k, v))
-
-            if state == "wset":
-                if hdr:
-                    hdr = False
-                    wset_header = re.findall(r"\w+", line)
-                    log.debug("working set header: {}".format(wset_header))
-                else:
-                    parts = re.findall(r"[^\s\t]+", line)
-                    if len(parts) == len(wset_header):
-                        t = int(parts[wset_header.index('t')])
-                        wssi = int(parts[wset_header.index('WSS_insn')])
-                        wssd = int(parts[wset_header.index('WSS_data')])
-                        sinf = None
-                        if with_info:
-                            try:
-                                sinf = int(parts[wset_header.index('info')])
-                            except (IndexError, ValueError):
-                                pass
-                        ret.append(dict(t=t, wssi=wssi, wssd=wssd, info=sinf))
-                        log.debug("wset point: t={}, i={}, d={}, pk={}".format(t, wssi, wssd, sinf))
-
-            if state == "sampleinfo" and with_info:
-                m = re.match(r"\[\s+(\d+)\] refs=(\d+), loc=(.*)$", line)
-                if m:
-                    if 'sampleinfo' not in info: info['sampleinfo'] = {}
-                    pkid = int(m.group(1))
-                    refs = int(m.group(2))
-                    loc = m.group(3)
-                    info['sampleinfo'][pkid] = dict(refs=refs, loc=loc)
-                    log.info("Sample info [{}]: refs={}, loc={}".format(pkid, refs, loc))
-
-    # --
-    log.info("Parsed {} lines, found {} data points".format(l, len(ret)))
-    return ret, info
+        return None, None
+
+    with wsreader.WsReader(fname) as r:
+        info = dict(r.header())
+        stats = r.samples_array()
+        if stats is None:
+            return None, info
+        log.info("Found {} data points".format(len(stats['t'])))
+        if with_info and r.has('Sample info'):
+            info['sampleinfo'] = r.sample_info()
+        elif not with_info:
+            stats['info'][:] = -1
+    return stats, info
+
+
+def cache_name(fname):
+    return fname + '.npz'
+
+
+def load_cached(fname, with_info):
+    """parsed columns from cache next to the file, if still valid"""
+    cname = cache_name(fname)
+    if not os.path.isfile(cname):
+        return None, None
+    st = os.stat(fname)
+    try:
+        c = np.load(cname)
+        meta = json.loads(str(c['meta']))
+        if meta['version'] != CACHE_VERSION or meta['size'] != st.st_size or \
+                meta['mtime'] != st.st_mtime:
+            return None, None
+        stats = dict((k, c[k]) for k in ('t', 'wssi', 'wssd', 'info'))
+    except (IOError, KeyError, ValueError):
+        return None, None
+    info = meta['info']
+    if 'sampleinfo' in info:
+        info['sampleinfo'] = dict((int(k), v) for k, v in info['sampleinfo'].items())
+    if not with_info:
+        stats['info'] = np.full(len(stats['t']), -1, dtype=np.int64)
+    log.info("Loaded cache {}".format(cname))
+    return stats, info
+
+
+def save_cache(fname, stats, info):
+    st = os.stat(fname)
+    meta = dict(version=CACHE_VERSION, size=st.st_size, mtime=st.st_mtime, info=info)
+    try:
+        with open(cache_name(fname), 'wb') as f:
+            np.savez(f, meta=json.dumps(meta), **stats)
+    except IOError as e:
+        log.warning("Cannot write cache: {}".format(e))
+
+
+def load(fname, with_info, use_cache):
+    if use_cache:
+        stats, info = load_cached(fname, with_info)
+        if stats is not None:
+            return stats, info
+    stats, info = parse_file(fname, True)
+    if stats is not None and use_cache:
+        save_cache(fname, stats, info)
+    if stats is not None and not with_info:
+        stats['info'][:] = -1
+    return stats, info
 
 
 def process(args):
     """parse the file and plot"""
-    stats, info = parse_file(args.file, not args.no_info)
-    if stats:
+    stats, info = load(args.file, not args.no_info, not args.no_cache)
+    if stats is not None and len(stats['t']) > 0:
         log.info("Successfully parsed files: {}".format(args.file))
     else:
         log.error("No data found in file")
@@ -201,6 +230,10 @@ def main(argv):
                         help='plot dimensions, e.g., -s<w>,<h>')
     parser.add_argument('-t', '--title', default=None,
                         help='title of plot')
+    parser.add_argument('-m', '--max-points', type=int, default=None,
+                        help='downsample to this many points per line [2 per pixel]')
+    parser.add_argument('--no-cache', action='store_true', default=False,
+                        help='neither read nor write parsed data to <file>.npz')
 
     # positional arguments
     parser.add_argument("file", help='file name to be parsed')
@@ -0,0 +1,388 @@
+"""
+Reader for output files of valgrind-ws.
+
+The file is memory-mapped and split into its sections (separated by lines "--")
+on first use. Each section is only parsed when it is asked for, so a script that
+needs the header does not pay for a table with millions of samples.
+
+Plain Python structures are returned by default; numpy and pandas are only
+imported by the methods that return them.
+
+Example:
+  r = WsReader('ws.out.1234')
+  r.header()['Tau']          # 100000
+  r.samples()[:3]            # [(0, 0, 0, None), (100000, 21, 80, None), ...]
+  r.samples_array()['wssd']  # numpy array
+  r.pages()[INSN]            # {page: (count, last access, location)}
+  norm = PageNormalizer(r.mappings(), r.header()['Page size'])
+  norm(0x4025000)            # ('/usr/bin/myprog', 37)
+"""
+import re
+import mmap
+import bisect
+
+INSN = 0
+DATA = 1
+
+CHUNK_SIZE = 16 * 1024 * 1024  # bytes of the working set table parsed at once
+SEPARATOR = b'\n--\n'
+NUMBER = re.compile(r"^[\d,]+(\.\d+)?$")
+
+
+def human_to_number(st):
+    """'1,234' -> 1234, '0.5' -> 0.5, None if not a number"""
+    try:
+        st = st.replace(',', '')
+        return float(st) if '.' in st else int(st)
+    except ValueError:
+        return None
+
+
+def location_parts(loc):
+    """(function, object) from a location as printed by valgrind"""
+    m = re.match(r"0x[0-9A-Fa-f]+: (.*?) \((?:in )?([^)]+)\)", loc)
+    if not m:
+        return None, None
+    obj = m.group(2)
+    if ':' in obj and not obj.startswith('/'):
+        obj = obj.rsplit(':', 1)[0]  # source file:line
+    return m.group(1), obj
+
+
+class PageNormalizer(object):
+    """
+    Maps page addresses onto (mapping, offset in pages), which can be matched across
+    runs with a different address space layout. File mappings are named by their
+    file, and offsets count from the lowest mapping of the file, such that code and
+    data of an object share a base. Other mappings are numbered per kind in order of
+    first touch ('heap#1', 'anon#3'); stack offsets count down from the top of the
+    stack (-1 is the topmost page). Pages outside all mappings give ('?', page number).
+    """
+
+    def __init__(self, mappings, pagesize):
+        self.pagesize = pagesize
+        bases = {}
+        for m in mappings:
+            if m['kind'] == 'file':
+                bases[m['name']] = min(bases.get(m['name'], m['start']), m['start'])
+        numbers = {}
+        ranges = []
+        for m in mappings:
+            if m['kind'] == 'file':
+                key, base = m['name'], bases[m['name']]
+            else:
+                numbers[m['kind']] = numbers.get(m['kind'], 0) + 1
+                key = '{}#{}'.format(m['kind'], numbers[m['kind']])
+                base = m['end'] if m['kind'] == 'stack' else m['start']
+            ranges.append((m['start'], m['end'], key, base))
+        ranges.sort()
+        self._starts = [r[0] for r in ranges]
+        self._ranges = ranges
+
+    def __call__(self, page):
+        k = bisect.bisect_right(self._starts, page) - 1
+        if k >= 0 and page < self._ranges[k][1]:
+            _, _, key, base = self._ranges[k]
+            return key, (page - base) // self.pagesize
+        return '?', page // self.pagesize
+
+
+class WsReader(object):
+
+    def __init__(self, fname):
+        self.fname = fname
+        self._map = None
+        self._sections = None
+        self._cache = {}
+
+    def close(self):
+        if self._map is not None:
+            if isinstance(self._map, mmap.mmap):
+                self._map.close()
+            self._map = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    ##################
+    # sections
+    ##################
+
+    def _open(self):
+        if self._map is None:
+            with open(self.fname, 'rb') as f:
+                try:
+                    self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+                except ValueError:
+                    self._map = b''  # empty file cannot be mapped
+        return self._map
+
+    def sections(self):
+        """dict of section title -> (start, end) byte offsets; the first section is 'preamble'"""
+        if self._sections is None:
+            m = self._open()
+            self._sections = {}
+            start = 0
+            first = True
+            while start < len(m):
+                end = m.find(SEPARATOR, start)
+                if end < 0:
+                    end = len(m)
+                # skip blank lines before the title
+                while start < end and m[start:start + 1] == b'\n':
+                    start += 1
+                if first:
+                    title = 'preamble'
+                    first = False
+                else:
+                    eol = m.find(b'\n', start, end)
+                    title = m[start:eol if eol >= 0 else end].decode('utf-8', 'replace')
+                    title = title.split(',')[0].rstrip(':')
+                if title:
+                    self._sections[title] = (start, end + 1)
+                start = end + len(SEPARATOR)
+            # code and data page lists are one section
+            if 'Code pages' in self._sections:
+                self._sections['Data pages'] = self._sections['Code pages']
+        return self._sections
+
+    def has(self, title):
+        return title in self.sections()
+
+    def _lines(self, title):
+        """lines of a section, empty list if not present"""
+        rng = self.sections().get(title)
+        if rng is None:
+            return []
+        return self._open()[rng[0]:rng[1]].decode('utf-8', 'replace').split('\n')
+
+    def _cached(self, key, func):
+        if key not in self._cache:
+            self._cache[key] = func()
+        return self._cache[key]
+
+    ##################
+    # parsers
+    ##################
+
+    def header(self):
+        """preamble as dict, numeric values converted (units dropped)"""
+        def parse():
+            ret = {}
+            for line in self._lines('preamble'):
+                m = re.match(r"([^:]+):[\s\t]*(.*)$", line)
+                if not m:
+                    continue
+                k, v = m.group(1).strip(), m.group(2).strip()
+                first = v.split(' ')[0]
+                if k != 'Command' and NUMBER.match(first):
+                    v = human_to_number(first)
+                ret[k] = v
+            return ret
+        return self._cached('header', parse)
+
+    def _table_range(self):
+        """column names and byte range of the rows of the working set table"""
+        start, end = self.sections()['Working sets']
+        m = self._open()
+        hdr_start = m.find(b'\n', start, end) + 1
+        rows = m.find(b'\n', hdr_start, end) + 1
+        columns = m[hdr_start:rows].decode('utf-8').split()
+        stop = m.find(b'\n\n', rows, end)
+        return columns, rows, (stop + 1 if stop >= 0 else end)
+
+    def columns(self):
+        """column names of the working set table"""
+        if not self.has('Working sets'):
+            return []
+        return self._table_range()[0]
+
+    def samples(self):
+        """list of (t, WSS_insn, WSS_data, info id or None)"""
+        def parse():
+            if not self.has('Working sets'):
+                return []
+            columns, start, stop = self._table_range()
+            it = columns.index('t')
+            ii = columns.index('WSS_insn')
+            idd = columns.index('WSS_data')
+            ik = columns.index('info') if 'info' in columns else None
+            ret = []
+            for line in self._open()[start:stop].decode('utf-8').split('\n'):
+                parts = line.split()
+                if len(parts) != len(columns):
+                    continue
+                info = parts[ik] if ik is not None else '-'
+                ret.append((int(parts[it]), int(parts[ii]), int(parts[idd]),
+                            int(info) if info != '-' else None))
+            return ret
+        return self._cached('samples', parse)
+
+    def samples_array(self):
+        """
+        Working set table as dict of numpy arrays t, wssi, wssd and info (-1 = none),
+        parsed in large chunks. Suitable for millions of samples.
+        """
+        def parse():
+            import numpy as np
+            if not self.has('Working sets'):
+                return None
+            columns, start, stop = self._table_range()
+            m = self._open()
+            parts = []
+            pos = start
+            while pos < stop:
+                cut = min(pos + CHUNK_SIZE, stop)
+                if cut < stop:
+                    cut = m.rfind(b'\n', pos, cut) + 1 or stop
+                data = m[pos:cut]
+                # info column uses a lone '-' for "none"
+                data = re.sub(br'(?<!\S)-(?!\S)', b'-1', data)
+                if data.strip():
+                    parts.append(np.fromstring(data, dtype=np.float64, sep=' '))
+                pos = cut
+            flat = np.concatenate(parts) if parts else np.zeros(0)
+            table = flat.reshape(-1, len(columns))
+            col = dict((c, i) for i, c in enumerate(columns))
+            return dict(t=table[:, col['t']].astype(np.int64),
+                        wssi=table[:, col['WSS_insn']].astype(np.int64),
+                        wssd=table[:, col['WSS_data']].astype(np.int64),
+                        info=table[:, col['info']].astype(np.int64) if 'info' in col
+                        else np.full(len(table), -1, dtype=np.int64))
+        return self._cached('samples_array', parse)
+
+    def to_dataframe(self):
+        """working set table as pandas DataFrame, indexed by t"""
+        import pandas as pd
+        arr = self.samples_array()
+        df = pd.DataFrame(dict(WSS_insn=arr['wssi'], WSS_data=arr['wssd'], info=arr['info']),
+                          index=pd.Index(arr['t'], name='t'))
+        df.loc[df['info'] < 0, 'info'] = None
+        return df
+
+    def summary(self):
+        """statistics after the working set table, as dict of strings"""
+        def parse():
+            ret = {}
+            if not self.has('Working sets'):
+                return ret
+            _, _, stop = self._table_range()
+            end = self.sections()['Working sets'][1]
+            for line in self._open()[stop:end].decode('utf-8', 'replace').split('\n'):
+                k, sep, v = line.partition(':')
+                if sep:
+                    ret[k.strip()] = v.strip()
+            return ret
+        return self._cached('summary', parse)
+
+    def pages(self):
+        """page lists (--ws-list-pages=yes) as [insn, data], each page -> (count, last, location)"""
+        def parse():
+            pages = [{}, {}]
+            cur = None
+            for line in self._lines('Code pages'):
+                if line.startswith("Code pages"):
+                    cur = pages[INSN]
+                    continue
+                if line.startswith("Data pages"):
+                    cur = pages[DATA]
+                    continue
+                m = re.match(r"\s*(\d+) (0x[0-9A-Fa-f]+)\s+(\d+)\s*(.*)$", line)
+                if m and cur is not None:
+                    cur[int(m.group(2), 16)] = (int(m.group(1)), int(m.group(3)), m.group(4))
+            return pages
+        return self._cached('pages', parse)
+
+    def mappings(self):
+        """
+        mappings of the listed pages (--ws-list-pages=yes) as list of dict(start, end, kind,
+        name), in order of first touch. kind is one of file, heap, stack, anon, shm.
+        """
+        def parse():
+            ret = []
+            for line in self._lines('Mappings')[2:]:
+                parts = line.split(None, 3)
+                if len(parts) >= 3 and parts[0].startswith('0x'):
+                    ret.append(dict(start=int(parts[0], 16), end=int(parts[1], 16),
+                                    kind=parts[2], name=parts[3] if len(parts) > 3 else None))
+            return ret
+        return self._cached('mappings', parse)
+
+    def sample_info(self):
+        """dict id -> dict(refs=, loc=)"""
+        def parse():
+            ret = {}
+            for line in self._lines('Sample info'):
+                m = re.match(r"\[\s*(\d+)\] refs=(\d+), loc=(.*)$", line)
+                if m:
+                    ret[int(m.group(1))] = dict(refs=int(m.group(2)), loc=m.group(3))
+            return ret
+        return self._cached('sample_info', parse)
+
+    def thread_stacks(self):
+        """list of (t, tid, entries, info id), see --ws-info-threads=yes"""
+        def parse():
+            ret = []
+            for line in self._lines('Thread stacks')[2:]:
+                parts = line.split()
+                if len(parts) == 4:
+                    ret.append(tuple(int(p) for p in parts))
+            return ret
+        return self._cached('thread_stacks', parse)
+
+    def heap_sites(self):
+        """list of (page-samples, bytes, location), see --ws-heap=yes"""
+        def parse():
+            ret = []
+            for line in self._lines('Heap sparse pages')[2:]:
+                parts = line.split(None, 2)
+                if len(parts) >= 2 and parts[0].isdigit():
+                    ret.append((int(parts[0]), int(parts[1]), parts[2] if len(parts) > 2 else ''))
+            return ret
+        return self._cached('heap_sites', parse)
+
+    def window_state(self):
+        """
+        window boundaries (--ws-start-at/--ws-stop-after) as dict start, stop (None if the
+        window never opened), and head/tail: {(kind, page): time}
+        """
+        def parse():
+            ret = dict(start=None, stop=None, head={}, tail={})
+            for line in self._lines('Window state')[1:]:
+                m = re.match(r"(Start|Stop):\s+(\d+)", line)
+                if m:
+                    ret[m.group(1).lower()] = int(m.group(2))
+                    continue
+                parts = line.split()
+                if len(parts) == 4 and parts[0] in ('head', 'tail'):
+                    kind = INSN if parts[1] == 'insn' else DATA
+                    ret[parts[0]][(kind, int(parts[2], 16))] = int(parts[3])
+            return ret
+        return self._cached('window_state', parse)
+
+    def first_touch(self):
+        """
+        first touch log (--ws-first-touch=log) as list of (t, page, kind, written, ip),
+        in order of time
+        """
+        def parse():
+            ret = []
+            in_log = False
+            for line in self._lines('First touch'):
+                if line.startswith('Log:'):
+                    in_log = True
+                    continue
+                parts = line.split()
+                if in_log and len(parts) == 5 and parts[0].isdigit():
+                    kind = INSN if parts[2] == 'insn' else DATA
+                    ret.append((int(parts[0]), int(parts[1], 16), kind, parts[3] == 'w',
+                                int(parts[4], 16)))
+            return ret
+        return self._cached('first_touch', parse)
+
+    def section_lines(self, title):
+        """raw lines of any other section, e.g. 'Locality statistics'"""
+        return self._lines(title)[1:]
@@ -0,0 +1,111 @@
+/*
+   ----------------------------------------------------------------
+
+   Notice that the following BSD-style license applies to this one
+   file (ws.h) only.  The rest of ws is licensed under the terms of
+   the GNU General Public License, version 2, unless otherwise
+   indicated.  See the COPYING file in the source distribution for
+   details.
+
+   ----------------------------------------------------------------
+
+   This file is part of ws, a Valgrind tool to compute working sets
+   of a process.
+
+   Copyright (C) 2018 Martin Becker
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+   2. The origin of this software must not be misrepresented; you must
+      not claim that you wrote the original software.  If you use this
+      software in a product, an acknowledgment in the product
+      documentation would be appreciated but is not required.
+
+   3. Altered source versions must be plainly marked as such, and must
+      not be misrepresented as being the original software.
+
+   4. The name of the author may not be used to endorse or promote
+      products derived from this software without specific prior written
+      permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+   OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+   ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+   ----------------------------------------------------------------
+
+   Notice that the above BSD-style license applies to this one file
+   (ws.h) only.  The entire rest of ws is licensed under
+   the terms of the GNU General Public License, version 2.  See the
+   COPYING file in the source distribution for details.
+
+   ----------------------------------------------------------------
+*/
+
+/* Client requests of ws. Programs which run natively are not affected,
+   the requests are no-ops outside of valgrind.
+
+   The allocator wrappers in vgpreload_ws use these to tell the tool about
+   heap blocks (see --ws-heap=yes). Programs with their own allocator can
+   issue them directly. The string functions in vgpreload_ws report the
+   ranges they read and write (see --ws-bulk-ranges). */
+
+#ifndef __WS_H
+#define __WS_H
+
+#include "valgrind.h"
+
+typedef
+   enum {
+      VG_USERREQ__WS_HEAP_ALLOC = VG_USERREQ_TOOL_BASE('W','S'),
+      VG_USERREQ__WS_HEAP_FREE,
+      VG_USERREQ__WS_RANGES,
+      VG_USERREQ__WS_BULK,
+      VG_USERREQ__WS_HEAP
+   } Vg_WsClientRequest;
+
+/* A heap block of _qzz_size bytes is live at _qzz_addr. A block that is
+   already known at that address is replaced. */
+#define VALGRIND_WS_HEAP_ALLOC(_qzz_addr, _qzz_size)                \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__WS_HEAP_ALLOC,        \
+                                   (_qzz_addr), (_qzz_size), 0, 0, 0)
+
+/* The heap block at _qzz_addr is freed. Unknown addresses are ignored. */
+#define VALGRIND_WS_HEAP_FREE(_qzz_addr)                             \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__WS_HEAP_FREE,         \
+                                   (_qzz_addr), 0, 0, 0, 0)
+
+/* _qzz_dlen bytes at _qzz_dst are written and _qzz_slen bytes at _qzz_src
+   are read, e.g. by memcpy. Either length may be 0. */
+#define VALGRIND_WS_ACCESS_RANGES(_qzz_dst, _qzz_dlen, _qzz_src, _qzz_slen) \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__WS_RANGES,            \
+                                   (_qzz_dst), (_qzz_dlen),          \
+                                   (_qzz_src), (_qzz_slen), 0)
+
+/* 1 if the tool takes ranges instead of instrumenting the code that
+   reports them (--ws-bulk-ranges=yes), 0 otherwise and when not running
+   under ws. */
+#define VALGRIND_WS_BULK_RANGES()                                    \
+   (unsigned)VALGRIND_DO_CLIENT_REQUEST_EXPR(0, VG_USERREQ__WS_BULK, \
+                                             0, 0, 0, 0, 0)
+
+/* 1 if the tool tracks heap blocks (--ws-heap=yes), 0 otherwise and when
+   not running under ws. The allocator wrappers only report blocks then. */
+#define VALGRIND_WS_HEAP_TRACKING()                                  \
+   (unsigned)VALGRIND_DO_CLIENT_REQUEST_EXPR(0, VG_USERREQ__WS_HEAP, \
+                                             0, 0, 0, 0, 0)
+
+#endif /* __WS_H */
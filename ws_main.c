@@ -45,7 +45,13 @@
 #include "pub_tool_threadstate.h"
 #include "pub_tool_xtree.h"
 #include "pub_tool_xarray.h"
+#include "pub_tool_wordfm.h"
+#include "pub_tool_vki.h"          // VKI_MADV_*
+#include "pub_tool_vkiscnums.h"    // __NR_madvise
+#include "pub_tool_aspacemgr.h"    // VG_(am_find_nsegment)
+#include "pub_tool_transtab.h"     // VG_(discard_translations_safely)
 #include "valgrind.h"
+#include "ws.h"
 
 /*------------------------------------------------------------*/
 /*--- version-specific defs                                ---*/
@@ -72,7 +78,9 @@
 /*--- type definitions                                     ---*/
 /*------------------------------------------------------------*/
 
-typedef unsigned long pagecount;
+typedef UInt pagecount;
+
+typedef enum { CodeUnknown=0, CodeStatic=1, CodeJit=2 } CodeKind;
 
 struct map_pageaddr
 {
@@ -80,12 +88,16 @@ struct map_pageaddr
   unsigned long int count;
   Time              last_access;
   DiEpoch           ep;  // FIXME: opt: we do not use debug info for data pages, remove ep for data?
+  UShort            gen;   // code pages: number of times translations were discarded, see --ws-jit
+  UShort            kind;  // code pages: CodeKind, classified on demand
 };
 
 #define vgPlain_malloc(size) vgPlain_malloc ((const char *) __func__, size)
 
 typedef enum { TimeI, TimeMS } TimeUnit;
 
+typedef enum { TrackBoth, TrackInsn, TrackData } TrackKind;
+
 typedef
    IRExpr
    IRAtom;
@@ -109,9 +121,14 @@ typedef
    }
    Event;
 
+/**
+ * @brief one working set sample, stored inline in a SampleStore.
+ * Time is stored as the delta to the intended sample time, i.e., the
+ * time of the previous sample plus --ws-every.
+ */
 typedef
    struct {
-      Time t; // FIXME: opt: we could store only the delta to the intended point in time.
+      Int       dt;
       pagecount pages_insn;
       pagecount pages_data;
    #ifdef DEBUG
@@ -120,6 +137,30 @@ typedef
    }
    WorkingSet;
 
+#define SAMPLES_PER_CHUNK 4096
+
+/**
+ * @brief all samples, in fixed-size chunks which are never moved
+ */
+typedef
+   struct {
+      XArray *chunks;  ///< of WorkingSet*, each SAMPLES_PER_CHUNK long
+      UInt    num;
+      Time    first_t; ///< intended time of the first sample, start of the window
+      Time    last_t;  ///< time of the latest sample
+   }
+   SampleStore;
+
+/**
+ * @brief position while iterating over a SampleStore
+ */
+typedef
+   struct {
+      UInt i;
+      Time t;
+   }
+   SampleIter;
+
 /**
  * @brief details for a single working set sample
  */
@@ -145,7 +186,9 @@ struct map_context2sampleinfo
  */
 typedef
    struct {
-      Time        t;
+      UInt        sample;   ///< index in ws_at_time
+      ThreadId    tid;
+      UInt        entries;  ///< pages this thread brought into the WS since previous info
       ExeContext *ec;
    }
    SampleContext;
@@ -184,11 +227,502 @@ typedef
    }
    LocalityInfo;
 
+/**
+ * @brief counters for one page table, see --ws-self-stats
+ */
+typedef
+   struct {
+      ULong helper_calls;  ///< calls of the trace helper
+      ULong cache_hits;    ///< accesses served by the one-item cache in pageaccess()
+      ULong lookups;       ///< hash table lookups
+      ULong inserts;       ///< new pages added to the table
+      ULong scan_nodes;    ///< nodes visited by recently_used_pages()
+   }
+   TableStats;
+
+/**
+ * @brief tool's own overhead, see --ws-self-stats
+ */
+typedef
+   struct {
+      TableStats insn, data;
+      ULong      helper_sb;        ///< calls of SB entered/exited helpers
+      ULong      samples;          ///< calls of compute_ws()
+      ULong      cyc_compute_ws;   ///< cycles spent in compute_ws()
+      ULong      cyc_compute_max;  ///< longest single compute_ws()
+      ULong      cyc_fini_sample;  ///< ws_fini: last sample
+      ULong      cyc_fini_info;    ///< ws_fini: resolving sample info
+      ULong      cyc_fini_pages;   ///< ws_fini: writing page lists
+      ULong      cyc_fini_table;   ///< ws_fini: writing working set table
+      ULong      cyc_fini_total;   ///< ws_fini: everything
+      ULong      tier_promoted;    ///< SBs re-instrumented as hot, see --ws-tiered
+   }
+   SelfStats;
+
+/**
+ * @brief one-item cache in front of a page table
+ */
+typedef
+   struct {
+      Addr                 addr;
+      struct map_pageaddr *page;
+   }
+   PageCache;
+
+/**
+ * @brief element in hash table of SBs promoted to the hot tier, see --ws-tiered
+ */
+struct map_hotsb
+{
+  VgHashNode top;  // guest address of the SB, must be first
+  SizeT      len;  ///< guest bytes of its first extent
+};
+
+#define TIER_CHUNK 4096  ///< execution counters per allocation
+
+#define HEAP_LINE_SIZE   64  ///< granularity of field offsets
+#define HEAP_FIELD_LINES 64  ///< lines per object with their own counter; beyond is one bucket
+#define HEAP_FIELD_SLOTS (2 * clo_heapfields_top)  ///< sites with a line histogram
+
+/**
+ * @brief element in hash table ExeContext -> field access heat, see --ws-heap-fields
+ */
+struct map_heapfields
+{
+  VgHashNode  top;      // ExeContext ECU, must be first
+  ExeContext *where;
+  ULong       entries;  ///< accesses which brought a page into the WS
+  ULong       accesses;
+  ULong      *hist;     ///< accesses per line from object start, NULL unless a top site
+  ULong       hist_accesses;  ///< accesses counted in hist
+  ULong       blocks;
+  ULong       lines_used;   ///< summed over blocks
+  ULong       lines_total;  ///< summed over blocks
+};
+
+/**
+ * @brief a live heap block, see --ws-heap
+ */
+typedef
+   struct {
+      Addr                   start;
+      SizeT                  size;
+      ExeContext            *where;   ///< allocation site
+      struct map_heapfields *fields;  ///< with --ws-heap-fields, else NULL
+      ULong                  touched; ///< lines accessed, bit HEAP_FIELD_LINES-1 also for all beyond
+   }
+   HeapBlock;
+
+/**
+ * @brief element in hash table heap page -> live bytes
+ */
+struct map_heappage
+{
+  VgHashNode top;  // page address, must be first
+  SizeT      live;
+};
+
+#define HEAP_OCC_BINS 4  ///< occupancy histogram in quarters of a page; the lowest is "sparse"
+
+/**
+ * @brief heap pages in the data WS at one sample, stored inline per sample
+ */
+typedef
+   struct {
+      pagecount pages;
+      ULong     live;                ///< live bytes on these pages
+      pagecount occ[HEAP_OCC_BINS];  ///< pages by occupancy
+   }
+   HeapSample;
+
+/**
+ * @brief element in hash table ExeContext -> blame for sparse pages
+ */
+struct map_heapsite
+{
+  VgHashNode  top;     // ExeContext ECU, must be first
+  ExeContext *where;
+  ULong       pages;   ///< sparse WS pages with blocks of this site, summed over samples
+  ULong       bytes;   ///< live bytes of this site on those pages, summed over samples
+  ULong       visit;   ///< last page visit that counted, to count each page once
+};
+
+/**
+ * @brief element in hash table anchor -> memory pool, see --ws-mempools
+ */
+struct map_pool
+{
+  VgHashNode  top;        // pool anchor as passed to VALGRIND_CREATE_MEMPOOL, must be first
+  ExeContext *where;      ///< where the pool was created
+  UInt        id;         ///< in order of creation
+  Bool        destroyed;
+  ULong       chunks;     ///< allocated in total
+  SizeT       live, peak_live;
+  pagecount   ws_now;     ///< pages in the current sample
+  pagecount   ws_max;
+  ULong       ws_sum;     ///< pages in the WS, summed over samples
+};
+
+/**
+ * @brief a live chunk of a memory pool
+ */
+typedef
+   struct {
+      Addr             start;
+      SizeT            size;
+      struct map_pool *pool;
+      ExeContext      *where;  ///< allocation site
+      ULong            seq;    ///< in order of allocation
+   }
+   PoolChunk;
+
+/**
+ * @brief element in hash table page -> live pool bytes. The page is accounted
+ * to pool and site of the latest live chunk allocated on it.
+ */
+struct map_poolpage
+{
+  VgHashNode       top;  // page address, must be first
+  SizeT            live;
+  struct map_pool *pool;
+  ExeContext      *where;
+  ULong            seq;  ///< of the chunk pool and where are taken from
+};
+
+/**
+ * @brief element in hash table ExeContext -> pool pages in the WS
+ */
+struct map_poolsite
+{
+  VgHashNode       top;    // ExeContext ECU, must be first
+  ExeContext      *where;
+  struct map_pool *pool;   ///< of the first chunk from here
+  ULong            pages;  ///< WS pages, summed over samples
+};
+
+/**
+ * @brief element in hash table page -> time it was purged, until it is touched again
+ */
+struct map_purged
+{
+  VgHashNode top;  // page address, must be first
+  Time       when;
+};
+
+#ifndef VKI_MADV_FREE
+#define VKI_MADV_FREE 8  // Linux 4.5
+#endif
+
+#define MADV_BINS 8  ///< refault distances in decades, from <1e3 to >=1e9
+
+/**
+ * @brief effect of madvise(DONTNEED/FREE), see --ws-madvise
+ */
+typedef
+   struct {
+      ULong calls_dontneed;
+      ULong calls_free;
+      ULong pages;        ///< data pages purged
+      ULong pages_in_ws;  ///< ... which were in the WS at that time
+      ULong refaults;
+      ULong refaults_tau; ///< refaulted within tau
+      ULong dist[MADV_BINS];
+   }
+   PurgeStats;
+
+#define STACK_ROLE_DEPTH 64         ///< frames to find the outermost function of a thread
+#define STACK_REC_STEP   (16 * 1024) ///< granularity of recommended stack sizes
+
+/**
+ * @brief stack usage of one thread, see --ws-stacks
+ */
+typedef
+   struct {
+      ThreadId     tid;
+      Addr         stack_min, stack_max;  ///< stack segment; 0 until first access
+      Addr         lowest;    ///< lowest address accessed on the stack
+      const HChar *role;      ///< outermost function which is not startup code
+      ULong        wss_sum;   ///< stack pages in the WS, summed over samples
+      ULong        samples;
+      UInt         wss_max;
+   }
+   ThreadStack;
+
+/**
+ * @brief element in hash table code page -> discard, until the page is executed again
+ */
+struct map_discarded
+{
+  VgHashNode        top;    // page address, must be first
+  Time              when;
+  unsigned long int count;  // accesses of the page at that time
+};
+
+/**
+ * @brief code cache at one sample, see --ws-jit
+ */
+typedef
+   struct {
+      pagecount wss_jit;  ///< code pages in the WS which are JIT code
+      pagecount churn;    ///< code pages discarded since previous sample
+   }
+   JitSample;
+
+/**
+ * @brief code regeneration, see --ws-jit
+ */
+typedef
+   struct {
+      ULong     discards;       ///< discard callbacks
+      ULong     evictions;      ///< ... of which valgrind recycled its code cache
+      ULong     pages;          ///< code pages discarded
+      ULong     retouched;      ///< ... and executed again
+      ULong     retouched_tau;  ///< ... within tau
+      ULong     jit_sum, static_sum;
+      pagecount jit_peak, static_peak;
+   }
+   JitStats;
+
+/**
+ * @brief data access volume of one sample interval, see --ws-volume
+ */
+typedef
+   struct {
+      ULong     read, written;  ///< bytes
+      ULong     accesses;
+      pagecount pages_data;     ///< data WSS at the end of the interval
+   }
+   VolumeSample;
+
+/**
+ * @brief measurement window, see --ws-start-at. Translations made while the
+ * window is not open only count instructions.
+ */
+typedef
+   enum { WindowBefore, WindowOpen, WindowClosing, WindowClosed }
+   WindowState;
+
+/**
+ * @brief page at a window boundary, see print_window_state()
+ */
+typedef
+   struct {
+      Addr page;
+      Time t;
+      UInt kind;  ///< AccessKind
+   }
+   WindowPage;
+
+/**
+ * @brief forecast evaluated at one sample, see --ws-forecast
+ */
+typedef
+   struct {
+      Int fcast;  ///< total WSS forecast for this sample, -1 if none
+      Int err;    ///< actual minus forecast
+   }
+   ForecastSample;
+
+/**
+ * @brief state of the forecaster and of the simulated limit policy
+ */
+typedef
+   struct {
+      ULong  n;           ///< samples seen
+      Double level, trend;
+      ULong  evaluated;
+      Double abs_err, bias;
+      ULong  exceeded;    ///< actual WSS above the limit
+      Double excess_sum, excess_max, slack_sum;
+   }
+   ForecastState;
+
+#define PF_DEGREE    2    ///< pages prefetched per miss by the sequential and stride prefetchers
+#define PF_BUFFER    64   ///< prefetched pages held per prefetcher, oldest are dropped
+#define PF_STRIDES   256  ///< entries of the stride prefetcher's table, by code site
+#define PF_WINDOW    10   ///< samples per row of the prefetch table
+#define PF_TOP_SITES 20
+
+/**
+ * @brief simulated page prefetchers, see --ws-prefetch
+ */
+typedef enum { PfSequential=0, PfStride=1, PfMarkov=2, PF_N=3 } PrefetcherKind;
+
+/**
+ * @brief element in hash table page -> position in the simulated resident
+ * set, a doubly-linked LRU list
+ */
+struct map_resident
+{
+  VgHashNode           top;  // page address, must be first
+  struct map_resident *newer, *older;
+};
+
+/**
+ * @brief a prefetched page, until it is used or dropped
+ */
+typedef
+   struct {
+      Addr page;   ///< 0 if the slot is free
+      Time issued;
+   }
+   PfEntry;
+
+/**
+ * @brief counters of one prefetcher; a useful prefetch is one that covered a miss
+ */
+typedef
+   struct {
+      ULong issued, useful, timely;
+      ULong lead_sum;  ///< time from issue to use, summed over useful prefetches
+   }
+   PfCounters;
+
+/**
+ * @brief one prefetcher: its buffer of prefetched pages, and counters
+ */
+typedef
+   struct {
+      PfEntry    buf[PF_BUFFER];
+      UInt       next;   ///< slot to fill next
+      PfCounters total, win;
+   }
+   Prefetcher;
+
+/**
+ * @brief entry of the Markov prefetcher: the last two misses after a miss on page
+ */
+typedef
+   struct {
+      Addr page;
+      Addr succ[2];  ///< most recent first
+   }
+   PfMarkovEntry;
+
+/**
+ * @brief entry of the stride prefetcher, per code site
+ */
+typedef
+   struct {
+      Addr ip;
+      Addr last;    ///< page of the last miss from here
+      Long stride;  ///< in bytes
+      Bool steady;  ///< the last two strides were equal
+   }
+   PfStrideEntry;
+
+/**
+ * @brief one row of the prefetch table, see print_prefetch()
+ */
+typedef
+   struct {
+      Time       t;  ///< end of the window
+      ULong      misses;
+      PfCounters pf[PF_N];
+   }
+   PfWindow;
+
+/**
+ * @brief element in hash table code address -> misses from there
+ */
+struct map_pfsite
+{
+  VgHashNode top;  // instruction address, must be first
+  DiEpoch    ep;
+  ULong      misses;
+  ULong      unpredicted;  ///< not covered by any prefetcher
+};
+
+#define FT_DATA      1  ///< in FirstTouch.page
+#define FT_WRITE     2
+#define FT_WRITE_SIZE ((SizeT) 1 << (8 * sizeof(SizeT) - 1))  ///< in the size arg of data helpers
+#define FT_BUFRECS   4096  ///< first touches buffered before they are written to the log file
+#define FT_PHASES    10
+#define FT_TOP_SITES 5
+
+/**
+ * @brief detail of the first touch log, see --ws-first-touch
+ */
+typedef enum { FirstTouchOff=0, FirstTouchSummary=1, FirstTouchLog=2 } FirstTouchMode;
+
+/**
+ * @brief first access to a page. Kind and write flag are kept in the low
+ * bits of the page address.
+ */
+typedef
+   struct {
+      Time    t;
+      Addr    page;  ///< | FT_DATA | FT_WRITE
+      Addr    ip;    ///< code site
+      DiEpoch ep;
+   }
+   FirstTouch;
+
+/**
+ * @brief pages touched for the first time in one sample interval
+ */
+typedef
+   struct {
+      pagecount insn, data;
+      Time      dt;  ///< length of the interval
+   }
+   FirstTouchSample;
+
+/**
+ * @brief element in hash table code address -> pages first touched from there
+ */
+struct map_ftsite
+{
+  VgHashNode top;  // instruction address, must be first
+  DiEpoch    ep;
+  ULong      pages;
+};
+
+/**
+ * @brief kinds of records in the access trace, see --ws-trace-file
+ */
+typedef enum { TraceInsn=0, TraceData=1, TraceSample=2, TracePurge=3 } TraceKind;
+
+typedef enum { AccessInsn=0, AccessData=1 } AccessKind;
+
+/**
+ * @brief an optional analysis, enabled by a command line flag.
+ * All hooks may be NULL. Instrumentation only calls into analyses for
+ * hooks that at least one enabled analysis has, so a disabled analysis
+ * costs nothing on the hot path.
+ */
+typedef
+   struct {
+      const HChar *name;
+      Bool        *enabled;
+      void (*init)(void);                                       ///< after options are parsed
+      void (*access)(AccessKind kind, Addr addr, SizeT size);   ///< every fetch/load/store, before page table
+      void (*page_entered)(AccessKind kind, Addr addr);         ///< access brought a page into the WS
+      void (*sb_entered)(void);
+      void (*sb_exited)(void);
+      void (*sample)(Time t, WorkingSet *ws, Bool *have_info);  ///< after every WS sample; may record info
+      void (*fini)(void);                                       ///< after the last sample
+      void (*header)(VgFile *fp);                               ///< extra columns in the WS table
+      void (*row)(VgFile *fp, UInt sample);                     ///< values of these columns
+      const HChar *section;                                     ///< title of output section
+      void (*print)(VgFile *fp);                                ///< prints the section
+   }
+   Analysis;
+
 /*------------------------------------------------------------*/
 /*--- prototypes                                           ---*/
 /*------------------------------------------------------------*/
 
 static void maybe_compute_ws (void);
+static void analyses_init (void);
+static void stacks_thread_exit (ThreadId tid);
+static IRExpr* add_counter (IRSB* sbOut, void *counter, IRExpr *n);
+static void tier_flush (IRSB* sb);
+static void tier_init (void);
+static void ws_start_client_code (ThreadId tid, ULong blocks_done);
+static void window_first_touch (VgHashTable *ht, Addr pageaddr);
+static void firsttouch_log (VgHashTable *ht, Addr pageaddr, Bool write);
+static void window_close (Time now);
 
 /*------------------------------------------------------------*/
 /*--- globals                                              ---*/
@@ -200,6 +734,10 @@ static Long guest_instrs_executed = 0;
 // page access tables
 static VgHashTable *ht_data;
 static VgHashTable *ht_insn;
+static struct map_pageaddr page_none;  // cached until the first access, never counted
+static PageCache    cache_data = { (Addr) -1, &page_none };  // -1 is never page-aligned
+static PageCache    cache_insn = { (Addr) -1, &page_none };
+static Time         next_sample_time = 0;
 static VgHashTable *ht_ec2sampleinfo;
 
 // list of user-defined points in time where sample info shall be recorded
@@ -207,12 +745,106 @@ static XArray *ws_info_times;
 static int     next_user_time_idx = -1;
 
 // working set at each point in time
-static XArray        *ws_at_time;
-static unsigned long  drop_samples = 0;
+static SampleStore ws_at_time;
 
-// list of sample contexts; on termination converted to SampleInfo
+// list of sample contexts (inline); on termination converted to SampleInfo
 static XArray *ws_context_list;
 
+// pages brought into the WS per thread since the previous info, for --ws-info-threads
+static UInt *thread_entries;
+
+// heap tracking, see --ws-heap
+static WordFM      *heap_blocks;    // start address -> HeapBlock*
+static VgHashTable *ht_heap;        // page -> live bytes, only pages with live blocks
+static VgHashTable *ht_heapsites;   // allocation site -> blame for sparse pages
+static XArray      *heap_samples;   // HeapSample per sample
+static ULong        heap_visit = 0;
+static VgHashTable *ht_heapfields;  // allocation site -> field access heat
+static struct map_heapfields **fields_hist_sites;  // sites with a line histogram
+static Int fields_hist_n = 0;
+static const HeapBlock *heap_last_block = NULL;  // one-item cache for heap_find()
+
+// memory pools, see --ws-mempools
+static VgHashTable *ht_pools;      // anchor -> map_pool
+static VgHashTable *ht_poolpages;  // page -> live pool bytes, only pages with live chunks
+static VgHashTable *ht_poolsites;  // allocation site -> WS pages
+static WordFM      *pool_chunks;   // start address -> PoolChunk*
+static XArray      *pool_samples;  // pagecount per sample
+static UInt         pool_ids = 0;
+static ULong        pool_seq = 0;   // chunks allocated so far
+
+// madvise tracking, see --ws-madvise
+static VgHashTable *ht_purged;
+static XArray      *purged_per_sample;  // UInt per sample
+static UInt         purged_since_sample = 0;
+static PurgeStats   purge_stats;
+
+// stack usage, see --ws-stacks
+static ThreadStack *thread_stacks;  // per tid, live threads
+static XArray      *stacks_done;    // ThreadStack of exited threads
+static XArray      *stack_roles;    // interned function names
+static XArray      *stack_wss;      // UInt per sample, all threads
+
+// code cache, see --ws-jit
+static VgHashTable *ht_discarded;
+static XArray      *jit_samples;    // JitSample per sample
+static pagecount    jit_churn = 0;  // since previous sample
+static JitStats     jit_stats;
+static Bool         jit_translating = False;  // from instrumenting until the client runs again
+
+// access volume, see --ws-volume. Counters are updated by inline IR.
+static ULong   vol_read = 0, vol_written = 0, vol_accesses = 0;
+static XArray *volume_samples;  // VolumeSample per sample
+
+// measurement window, see --ws-start-at
+static WindowState window_state = WindowOpen;
+static Time        window_start = 0, window_stop = 0;  // actual
+static Time        window_stop_at = (Time) -1;          // requested
+static Time        window_head_end = 0;  // first accesses before this time are logged
+
+// translations discarded by the tool itself, not by the client
+static Bool        discarding_own = False;
+
+// tiered instrumentation, see --ws-tiered
+static VgHashTable *ht_hotsb;       // guest address of SB -> map_hotsb
+static XArray      *tier_pending;   // map_hotsb*, promoted since the last thread switch
+static XArray      *tier_counters;  // ULong*, chunks of execution counters
+static UInt         tier_nctr = 0;
+static Bool         tier_hot = False;  // SB being instrumented is hot
+static XArray     *window_head;          // WindowPage
+static XArray     *window_tail;          // WindowPage
+
+// forecasting, see --ws-forecast
+static XArray       *forecast_samples;  // ForecastSample per sample
+static Double       *forecast_ring;     // forecasts for the next --ws-forecast samples
+static ForecastState forecast_state;
+
+// prefetcher simulation, see --ws-prefetch
+static VgHashTable         *ht_resident;    // page -> map_resident
+static struct map_resident *resident_mru, *resident_lru;
+static UInt                 resident_n = 0;
+static Addr                 resident_last = (Addr) -1;  // one-item cache, already MRU
+static ULong                pf_accesses = 0, pf_misses = 0, pf_win_misses = 0;
+static Addr                 pf_ip = 0;          // instruction of the current access
+static Addr                 pf_last_miss = 0;
+static Prefetcher           prefetchers[PF_N];
+static PfMarkovEntry       *pf_markov;         // --ws-prefetch-table entries
+static PfStrideEntry        pf_strides[PF_STRIDES];
+static VgHashTable         *ht_pfsites;        // code address -> map_pfsite
+static XArray              *pf_windows;        // PfWindow per PF_WINDOW samples
+static UInt                 pf_win_samples = 0;
+
+// first touch log, see --ws-first-touch. Written to a file during the run, read back at the end.
+static FirstTouch ft_buf[FT_BUFRECS];
+static Int        ft_used = 0;
+static Int        ft_fd = -1;
+static HChar     *ft_fname = NULL;
+static ULong      ft_flushed = 0;  // records in the file
+static ULong      ft_chunk = 0;    // first record in ft_buf, when reading back
+static Int        ft_chunk_n = 0;
+static XArray    *ft_samples;  // FirstTouchSample per sample
+static pagecount  ft_new_insn = 0, ft_new_data = 0;  // since previous sample
+
 // locality info
 LocalityInfo locality_insn, locality_data;
 static ULong n_SBs_entered = 0;
@@ -256,6 +888,28 @@ static Int   events_used = 0;
 
 PeakDetect   pd_data, pd_insn;
 
+static SelfStats self_stats;
+
+// enabled analyses per hook, see analyses[]
+#define MAX_ANALYSES 16
+static const Analysis *hook_access[MAX_ANALYSES];
+static const Analysis *hook_page_entered[MAX_ANALYSES];
+static const Analysis *hook_sb_entered[MAX_ANALYSES];
+static const Analysis *hook_sb_exited[MAX_ANALYSES];
+static const Analysis *hook_sample[MAX_ANALYSES];
+static Int n_hook_access = 0, n_hook_sb_entered = 0, n_hook_sb_exited = 0, n_hook_sample = 0;
+static Int n_hook_page_entered = 0;
+
+// access trace: magic, page size, every, tau, then records of
+// three words (time, address, kind | size << 8)
+#define TRACE_MAGIC   "WSTRACE1"
+#define TRACE_BUFRECS 4096
+static Int   trace_fd = -1;
+static ULong trace_buf[3 * TRACE_BUFRECS];
+static Int   trace_used = 0;
+
+#define SELF_STAT(x) do { if (UNLIKELY(clo_selfstats)) { x; } } while (0)
+
 /*------------------------------------------------------------*/
 /*--- Command line options                                 ---*/
 /*------------------------------------------------------------*/
@@ -269,12 +923,43 @@ PeakDetect   pd_data, pd_insn;
 #define WS_DEFAULT_PEAKT 5
 #define WS_DEFAULT_PEAKW 30
 #define WS_DEFAULT_PEAKADP 0.25f ///< default value for peak filter. lower=more robust to bursts
+#define WS_DEFAULT_FC_ALPHA 0.5
+#define WS_DEFAULT_FC_BETA  0.1
+#define WS_DEFAULT_FC_HEADROOM 0.1
+#define WS_DEFAULT_PF_TABLE 4096
+#define WS_DEFAULT_PF_LATENCY 10000
 
 // user inputs:
 static Bool  clo_locations  = True;
 static Bool  clo_listpages  = False;
 static Bool  clo_peakdetect = False;
 static Bool  clo_localitytr = False;
+static Bool  clo_selfstats  = False;
+static Bool  clo_trace      = False;  // set by --ws-trace-file
+static Bool  clo_infothreads = False;
+static Bool  clo_heap       = False;
+static Bool  clo_heapfields = False;  // set by --ws-heap-fields
+static Int   clo_heapfields_top = 0;
+static Bool  clo_madvise    = False;
+static Bool  clo_mempools   = False;
+static Bool  clo_stacks     = False;
+static Bool  clo_jit        = False;
+static Bool  clo_volume     = False;
+static Bool  clo_forecasting = False;  // set by --ws-forecast
+static Int   clo_forecast   = 0;
+static Bool  clo_prefetching = False;  // set by --ws-prefetch
+static Int   clo_prefetch   = 0;
+static Int   clo_prefetch_table = WS_DEFAULT_PF_TABLE;
+static Int   clo_prefetch_latency = WS_DEFAULT_PF_LATENCY;
+static Bool  clo_firsttouching = False;  // set by --ws-first-touch
+static Int   clo_firsttouch = FirstTouchOff;
+static Bool  clo_bulk       = False;
+static Bool  clo_window     = False;  // set by --ws-start-at/--ws-stop-after
+static Long  clo_start_at   = 0;
+static Long  clo_stop_after = 0;
+static Double clo_forecast_alpha = WS_DEFAULT_FC_ALPHA;
+static Double clo_forecast_beta  = WS_DEFAULT_FC_BETA;
+static Double clo_forecast_headroom = WS_DEFAULT_FC_HEADROOM;
 static Int   clo_peakthresh = WS_DEFAULT_PEAKT;  // FIXME: Float?
 static Int   clo_peakwindow = WS_DEFAULT_PEAKW;
 static Float clo_peakadapt  = WS_DEFAULT_PEAKADP;  // FIXME: from clo
@@ -282,6 +967,8 @@ static Int   clo_pagesize   = WS_DEFAULT_PS;
 static Int   clo_every      = WS_DEFAULT_EVERY;
 static Int   clo_tau        = 0;
 static Int   clo_time_unit  = TimeI;
+static Int   clo_track      = TrackBoth;
+static Int   clo_tiered     = 0;
 
 /* The name of the function of which the number of calls (under
  * --basic-counts=yes) is to be counted, with default. Override with command
@@ -289,6 +976,7 @@ static Int   clo_time_unit  = TimeI;
 //static const HChar* clo_fnname = "main";
 static const HChar* clo_filename = "ws.out.%p";
 static const HChar* clo_info_at = "";
+static const HChar* clo_tracefile = NULL;
 static HChar* int_filename;
 
 /*------------------------------------------------------------*/
@@ -305,6 +993,37 @@ Float exp_approx(Float x)
   return x;
 }
 
+/**
+ * @brief read the CPU's cycle counter, for --ws-self-stats.
+ * Other than on x86/amd64 this is a timer with lower resolution, or zero
+ * if there is none.
+ */
+static inline
+ULong read_cycles(void)
+{
+#if defined(VGA_x86) || defined(VGA_amd64)
+   UInt lo, hi;
+   __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+   return (((ULong) hi) << 32) | lo;
+#elif defined(VGA_arm64)
+   ULong t;
+   __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (t));
+   return t;
+#elif defined(VGA_ppc64be) || defined(VGA_ppc64le)
+   ULong t;
+   __asm__ __volatile__ ("mftb %0" : "=r" (t));
+   return t;
+#else
+   return 0;
+#endif
+}
+
+static
+unsigned int percent(ULong part, ULong whole)
+{
+   return whole > 0 ? (unsigned int) ((100.f * part) / whole) : 0;
+}
+
 /*------------------------------------------------------------*/
 /*--- all other functions                                  ---*/
 /*------------------------------------------------------------*/
@@ -321,8 +1040,67 @@ Bool ws_process_cmd_line_option(const HChar* arg)
    else if VG_INT_CLO(arg, "--ws-tau", clo_tau) { tl_assert(clo_tau > 0); }
    else if VG_XACT_CLO(arg, "--ws-time-unit=i", clo_time_unit, TimeI)  {}
    else if VG_XACT_CLO(arg, "--ws-time-unit=ms", clo_time_unit, TimeMS) {}
+   else if VG_INT_CLO(arg, "--ws-tiered", clo_tiered) { tl_assert(clo_tiered >= 0); }
+   else if VG_XACT_CLO(arg, "--ws-track=both", clo_track, TrackBoth) {}
+   else if VG_XACT_CLO(arg, "--ws-track=insn", clo_track, TrackInsn) {}
+   else if VG_XACT_CLO(arg, "--ws-track=data", clo_track, TrackData) {}
    else if VG_BOOL_CLO(arg, "--ws-peak-detect", clo_peakdetect) {}
    else if VG_BOOL_CLO(arg, "--ws-track-locality", clo_localitytr) {}
+   else if VG_BOOL_CLO(arg, "--ws-info-threads", clo_infothreads) {}
+   else if VG_BOOL_CLO(arg, "--ws-heap", clo_heap) {}
+   else if VG_BOOL_CLO(arg, "--ws-madvise", clo_madvise) {}
+   else if VG_BOOL_CLO(arg, "--ws-mempools", clo_mempools) {}
+   else if VG_BOOL_CLO(arg, "--ws-stacks", clo_stacks) {}
+   else if VG_BOOL_CLO(arg, "--ws-jit", clo_jit) {}
+   else if VG_BOOL_CLO(arg, "--ws-volume", clo_volume) {}
+   else if VG_BOOL_CLO(arg, "--ws-bulk-ranges", clo_bulk) {}
+   else if VG_XACT_CLO(arg, "--ws-first-touch=no", clo_firsttouch, FirstTouchOff) {
+      clo_firsttouching = False;
+   }
+   else if VG_XACT_CLO(arg, "--ws-first-touch=yes", clo_firsttouch, FirstTouchSummary) {
+      clo_firsttouching = True;
+   }
+   else if VG_XACT_CLO(arg, "--ws-first-touch=log", clo_firsttouch, FirstTouchLog) {
+      clo_firsttouching = True;
+   }
+   else if VG_INT_CLO(arg, "--ws-forecast", clo_forecast) {
+      tl_assert(clo_forecast >= 0);
+      clo_forecasting = clo_forecast > 0;
+   }
+   else if VG_INT_CLO(arg, "--ws-prefetch", clo_prefetch) {
+      tl_assert(clo_prefetch >= 0);
+      clo_prefetching = clo_prefetch > 0;
+   }
+   else if VG_INT_CLO(arg, "--ws-prefetch-table", clo_prefetch_table) {
+      tl_assert(clo_prefetch_table > 0);
+   }
+   else if VG_INT_CLO(arg, "--ws-prefetch-latency", clo_prefetch_latency) {
+      tl_assert(clo_prefetch_latency >= 0);
+   }
+   else if VG_INT_CLO(arg, "--ws-start-at", clo_start_at) {
+      tl_assert(clo_start_at >= 0);
+      clo_window = True;
+   }
+   else if VG_INT_CLO(arg, "--ws-stop-after", clo_stop_after) {
+      tl_assert(clo_stop_after > 0);
+      clo_window = True;
+   }
+   else if VG_DBL_CLO(arg, "--ws-forecast-alpha", clo_forecast_alpha) {
+      tl_assert(clo_forecast_alpha > 0. && clo_forecast_alpha <= 1.);
+   }
+   else if VG_DBL_CLO(arg, "--ws-forecast-beta", clo_forecast_beta) {
+      tl_assert(clo_forecast_beta >= 0. && clo_forecast_beta <= 1.);
+   }
+   else if VG_DBL_CLO(arg, "--ws-forecast-headroom", clo_forecast_headroom) {
+      tl_assert(clo_forecast_headroom >= 0.);
+   }
+   else if VG_INT_CLO(arg, "--ws-heap-fields", clo_heapfields_top) {
+      tl_assert(clo_heapfields_top >= 0);
+      clo_heapfields = clo_heapfields_top > 0;
+      if (clo_heapfields) clo_heap = True;
+   }
+   else if VG_BOOL_CLO(arg, "--ws-self-stats", clo_selfstats) {}
+   else if VG_STR_CLO(arg, "--ws-trace-file", clo_tracefile) { clo_trace = True; }
    else if VG_INT_CLO(arg, "--ws-peak-window", clo_peakwindow) { tl_assert(clo_peakwindow > 0); }
    else if VG_INT_CLO(arg, "--ws-peak-thresh", clo_peakthresh) { tl_assert(clo_peakthresh > 0); }
    else return False;
@@ -339,19 +1117,54 @@ void ws_print_usage(void)
 {
    VG_(printf)(
 "    --ws-file=<string>            file name to write results\n"
-"    --ws-list-pages=no|yes        print list of all accessed pages [no]\n"
+"    --ws-list-pages=no|yes        list accessed pages and their mappings [no]\n"
 "    --ws-locations=no|yes         collect location info for insn pages in listing [yes]\n"
 "    --ws-peak-detect=no|yes       collect info for peaks in working set [no]\n"
 "    --ws-peak-window=<int>        window length (in samples) for peak detection [%d]\n"
 "    --ws-peak-thresh=<int>        threshold for peaks. Lower is more sensitive [%d]\n"
 "    --ws-info-at=<int>(,<int>)*   list of points in time where additional information shall be recorded\n"
+"    --ws-info-threads=no|yes      record stacks of all threads at info points, not only the running one [no]\n"
 "    --ws-track-locality=no|yes    compute locality of access\n"
+"    --ws-heap=no|yes              track live bytes on heap pages and blame sparse pages [no]\n"
+"    --ws-heap-fields=<int>        accessed offsets within objects of the top <int> allocation sites;\n"
+"                                  implies --ws-heap=yes [0]\n"
+"    --ws-mempools=no|yes          data WS per memory pool (VALGRIND_CREATE_MEMPOOL etc.) [no]\n"
+"    --ws-madvise=no|yes           drop pages purged with madvise(DONTNEED/FREE) from the WS,\n"
+"                                  and report refaults [no]\n"
+"    --ws-stacks=no|yes            stack high-water and stack WSS per thread [no]\n"
+"    --ws-jit=no|yes               separate JIT code from static code, track code regeneration [no]\n"
+"    --ws-volume=no|yes            bytes read and written per sample interval [no]\n"
+"    --ws-bulk-ranges=no|yes       memcpy, memset etc. report their ranges at once, instead of\n"
+"                                  instrumenting every access [no]\n"
+"    --ws-first-touch=no|yes|log   footprint growth per sample and phase, with the code sites that\n"
+"                                  touched new pages; log also lists every first touch [no]\n"
+"    --ws-forecast=<int>           forecast total WSS <int> samples ahead, and simulate a memory\n"
+"                                  limit following the forecast [0 = off]\n"
+"    --ws-forecast-alpha=<float>   smoothing of level [%.1f]\n"
+"    --ws-forecast-beta=<float>    smoothing of trend [%.1f]\n"
+"    --ws-forecast-headroom=<float> limit is forecast plus this fraction [%.1f]\n"
+"    --ws-prefetch=<int>           simulate page prefetchers on the misses of an LRU resident set\n"
+"                                  of <int> pages [0 = off]\n"
+"    --ws-prefetch-table=<int>     entries of the Markov prefetcher's table [%d]\n"
+"    --ws-prefetch-latency=<int>   a prefetch is timely if issued this long before use [%d]\n"
+"    --ws-start-at=<int>           measure only from this time on; instrumentation is off before [0]\n"
+"    --ws-stop-after=<int>         stop measuring this long after --ws-start-at [run to end]\n"
+"    --ws-self-stats=no|yes        count and time the tool's own overhead [no]\n"
+"    --ws-trace-file=<string>      record all page accesses and samples to this file (for testing)\n"
 "    --ws-pagesize=<int>           size of VM pages in bytes [%d]\n"
+"    --ws-tiered=<int>             re-instrument SBs executed <int> times with inline page checks\n"
+"                                  [0 = off]\n"
+"    --ws-track=both|insn|data     pages to track; the other kind is not instrumented [both]\n"
 "    --ws-time-unit=i|ms           time unit: instructions executed (default), milliseconds\n"
 "    --ws-every=<int>              sample working set every <int> time units [%d]\n"
 "    --ws-tau=<int>                consider all accesses made in the last tau time units [%d]\n",
    WS_DEFAULT_PEAKW,
    WS_DEFAULT_PEAKT,
+   WS_DEFAULT_FC_ALPHA,
+   WS_DEFAULT_FC_BETA,
+   WS_DEFAULT_FC_HEADROOM,
+   WS_DEFAULT_PF_TABLE,
+   WS_DEFAULT_PF_LATENCY,
    WS_DEFAULT_PS,
    WS_DEFAULT_EVERY,
    WS_DEFAULT_TAU
@@ -509,48 +1322,375 @@ inline void track_locality(LocalityInfo *li, Addr addr)
    li->n++;  ///< technically, we could derive this from #page accesses. But it's ~no overhead.
 }
 
+static
+void locality_init(void)
+{
+   init_locality(&locality_data);
+   init_locality(&locality_insn);
+}
+
+static
+void locality_access(AccessKind kind, Addr addr, SizeT size)
+{
+   track_locality(kind == AccessInsn ? &locality_insn : &locality_data, addr);
+}
+
+static
+void locality_sb_entered(void)
+{
+   n_SBs_entered++;
+}
+
+static
+void locality_sb_exited(void)
+{
+   n_SBs_exited++;
+}
+
+static
+void print_locality_stats(VgFile *fp)
+{
+   VG_(fprintf) (fp, "Insn refs/avg dist: %'lu/%'lu\n",
+                 locality_insn.n,
+                 (unsigned long) (locality_insn.sum / ((Float)locality_insn.n)));
+   VG_(fprintf) (fp, "Data refs/avg dist: %'lu/%'lu\n",
+                 locality_data.n,
+                 (unsigned long) (locality_data.sum / ((Float)locality_data.n)));
+   VG_(fprintf) (fp, "SB len enter/exits: %.1f/%.1f\n",
+                 guest_instrs_executed / ((Float) n_SBs_entered),
+                 guest_instrs_executed / ((Float) n_SBs_exited));
+}
+
+static
+void trace_flush(void)
+{
+   if (trace_used > 0) {
+      VG_(write) (trace_fd, trace_buf, trace_used * sizeof(trace_buf[0]));
+      trace_used = 0;
+   }
+}
+
+/**
+ * @brief append one record to the access trace
+ */
+static
+void trace_record(Time t, Addr addr, SizeT size, TraceKind kind)
+{
+   if (trace_used == 3 * TRACE_BUFRECS) trace_flush();
+   trace_buf[trace_used++] = (ULong) t;
+   trace_buf[trace_used++] = (ULong) addr;
+   trace_buf[trace_used++] = (ULong) kind | ((ULong) size << 8);
+}
+
+static
+void trace_open(void)
+{
+   HChar *fname = VG_(expand_file_name)("--ws-trace-file", clo_tracefile);
+   trace_fd = VG_(fd_open) (fname, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                                   VKI_S_IRUSR|VKI_S_IWUSR);
+   if (trace_fd < 0) {
+      VG_(umsg)("error: can't open trace file '%s', not tracing\n", fname);
+   } else {
+      VG_(umsg)("Tracing accesses to '%s'\n", fname);
+      const ULong hdr[3] = { clo_pagesize, clo_every, clo_tau };
+      VG_(write) (trace_fd, TRACE_MAGIC, 8);
+      VG_(write) (trace_fd, hdr, sizeof(hdr));
+   }
+   VG_(free) (fname);
+}
+
+static
+void trace_close(void)
+{
+   if (trace_fd < 0) return;
+   trace_flush();
+   VG_(close) (trace_fd);
+   trace_fd = -1;
+}
+
+/**
+ * @brief after fork the child would write into the parent's trace; stop tracing there.
+ */
+static
+void trace_atfork_child(ThreadId tid)
+{
+   if (trace_fd < 0) return;
+   VG_(close) (trace_fd);
+   trace_fd = -1;
+   trace_used = 0;
+}
+
+static
+void trace_init(void)
+{
+   trace_open();
+   VG_(atfork) (NULL, NULL, trace_atfork_child);
+}
+
+static
+void trace_access(AccessKind kind, Addr addr, SizeT size)
+{
+   if (trace_fd >= 0) trace_record (get_time(), addr, size, (TraceKind) kind);
+}
+
+static
+void trace_sample(Time t, WorkingSet *ws, Bool *have_info)
+{
+   if (trace_fd >= 0) trace_record (t, 0, 0, TraceSample);
+}
+
+/* --- Mappings of touched pages (--ws-list-pages) --- */
+
+typedef enum { MapFile, MapHeap, MapStack, MapAnon, MapShm } MappingKind;
+
+static const HChar *mapping_kind_names[] = { "file", "heap", "stack", "anon", "shm" };
+
+typedef struct {
+   Addr        start;    // [start, end) as of the latest page touched in it
+   Addr        end;
+   SegKind     segkind;
+   MappingKind kind;
+   HChar      *name;     // file name, or NULL
+   Bool        dead;     // unmapped, and its range was taken over by another mapping
+} Mapping;
+
+static WordFM  *mappings = NULL;      // start -> Mapping*, ranges do not overlap
+static XArray  *mapping_list = NULL;  // Mapping*, in order of first touch
+static Mapping *mapping_last = NULL;
+static Addr     brk_base = 0;         // start of the heap, from the first brk()
+
+static
+void mappings_init(void)
+{
+   mappings = VG_(newFM) (VG_(malloc), "ws.mappings", VG_(free), NULL);
+   mapping_list = VG_(newXA) (VG_(malloc), "arr_mappings", VG_(free), sizeof(Mapping*));
+}
+
+static
+Mapping* mapping_find(Addr addr)
+{
+   Mapping *m = mapping_last;
+   if (m && addr >= m->start && addr < m->end) return m;
+
+   UWord k, v;
+   if (!VG_(lookupFM) (mappings, &k, &v, addr) &&
+       !VG_(findBoundsFM) (mappings, &k, &v, NULL, NULL, 0, 0, ~(UWord) 0, 0, addr)) {
+      return NULL;
+   }
+   m = (Mapping *) v;
+   if (m == NULL || addr >= m->end) return NULL;
+   mapping_last = m;
+   return m;
+}
+
+/**
+ * @brief record of a mapping which overlaps [start, end), NULL if none
+ */
+static
+Mapping* mapping_overlap(Addr start, Addr end)
+{
+   Mapping *m = mapping_find (start);
+   if (m) return m;
+   UWord k, v;
+   if (VG_(findBoundsFM) (mappings, NULL, NULL, &k, &v, 0, 0, ~(UWord) 0, 0, start) && k < end)
+      return (Mapping *) v;
+   return NULL;
+}
+
+static
+MappingKind mapping_classify(const NSegment *seg)
+{
+   if (seg->kind == SkFileC) return MapFile;
+   if (seg->kind == SkShmC) return MapShm;
+   if (brk_base >= seg->start && brk_base <= seg->end) return MapHeap;
+
+   ThreadId tid;
+   Addr stack_min, stack_max;
+   VG_(thread_stack_reset_iter) (&tid);
+   while (VG_(thread_stack_next) (&tid, &stack_min, &stack_max)) {
+      if (stack_max >= seg->start && stack_max <= seg->end) return MapStack;
+   }
+   return MapAnon;
+}
+
+/**
+ * @brief a page was touched for the first time: record the mapping it belongs to,
+ * such that page lists can be related to mappings instead of absolute addresses.
+ * Mappings which grew (heap upwards, stacks downwards) keep their record.
+ */
+static
+void mapping_note(Addr pageaddr)
+{
+   if (mapping_find (pageaddr)) return;
+   const NSegment *seg = VG_(am_find_nsegment) (pageaddr);
+   if (seg == NULL || (seg->kind != SkFileC && seg->kind != SkAnonC && seg->kind != SkShmC))
+      return;
+   const HChar *name = VG_(am_get_filename) (seg);
+
+   Mapping *m, *keep = NULL;
+   while ((m = mapping_overlap (seg->start, seg->end + 1))) {
+      VG_(delFromFM) (mappings, NULL, NULL, m->start);
+      if (keep == NULL && m->segkind == seg->kind &&
+          (m->name == NULL ? name == NULL : name != NULL && VG_(strcmp) (m->name, name) == 0)) {
+         keep = m;
+      } else {
+         m->dead = True;
+      }
+   }
+   if (keep == NULL) {
+      keep = VG_(malloc) (sizeof(*keep));
+      keep->segkind = seg->kind;
+      keep->kind = mapping_classify (seg);
+      keep->name = name ? VG_(strdup) ("ws.mapname", name) : NULL;
+      keep->dead = False;
+      VG_(addToXA) (mapping_list, &keep);
+   } else if (keep->kind == MapAnon) {
+      keep->kind = mapping_classify (seg);
+   }
+   keep->start = seg->start;
+   keep->end = seg->end + 1;
+   VG_(addToFM) (mappings, keep->start, (UWord) keep);
+   mapping_last = keep;
+}
+
+static
+void print_mappings(VgFile *fp)
+{
+   Int n = 0;
+   for (Word i = 0; i < VG_(sizeXA) (mapping_list); i++) {
+      if (!(*(Mapping **) VG_(indexXA) (mapping_list, i))->dead) n++;
+   }
+   VG_(fprintf) (fp, "%'d entries:\n%18s %18s %-5s %s", n, "start", "end", "kind", "name");
+   for (Word i = 0; i < VG_(sizeXA) (mapping_list); i++) {
+      const Mapping *m = *(Mapping **) VG_(indexXA) (mapping_list, i);
+      if (m->dead) continue;
+      VG_(fprintf) (fp, "\n%018p %018p %-5s %s", (void*)m->start, (void*)m->end,
+                    mapping_kind_names[m->kind], m->name ? m->name : "");
+   }
+   VG_(fprintf) (fp, "\n");
+}
+
+static
+void mappings_destroy(void)
+{
+   for (Word i = 0; i < VG_(sizeXA) (mapping_list); i++) {
+      Mapping *m = *(Mapping **) VG_(indexXA) (mapping_list, i);
+      if (m->name) VG_(free) (m->name);
+      VG_(free) (m);
+   }
+   VG_(deleteXA) (mapping_list);
+   VG_(deleteFM) (mappings, NULL, NULL);
+}
+
+/**
+ * @brief count access to page, and maybe take a sample
+ * @return True if the page was not in the working set before
+ */
 // TODO: pages shared between processes?
 static
-inline void pageaccess(Addr pageaddr, VgHashTable *ht)
+inline Bool pageaccess(Addr pageaddr, VgHashTable *ht, PageCache *cache, TableStats *st, UInt n,
+                       SizeT size)
 {
-   // this is a one-item cache, exploiting locality and speeding up sim dramatically
-   static Addr                 lastaddr = 0;
-   static struct map_pageaddr *lastpage = NULL;
-   struct map_pageaddr        *page;
-   if (pageaddr == lastaddr) {
-      page = lastpage;
+   // this is a one-item cache, exploiting locality and speeding up sim dramatically.
+   // Separate per table, since code and data can share a page.
+   struct map_pageaddr *page;
+   SELF_STAT(st->helper_calls++);
+   if (pageaddr == cache->addr) {
+      page = cache->page;
+      SELF_STAT(st->cache_hits++);
    } else {
       page = VG_(HT_lookup) (ht, pageaddr);  // FIXME: might be a bottleneck
+      SELF_STAT(st->lookups++);
       if (page == NULL) {
+         SELF_STAT(st->inserts++);
          page = VG_(malloc) (sizeof (*page));
          page->top.key = pageaddr;
          page->count = 0;
          page->ep = VG_(current_DiEpoch)();
+         page->gen = 0;
+         page->kind = CodeUnknown;
          VG_(HT_add_node) (ht, (VgHashNode *) page);
+         if (UNLIKELY(clo_window)) window_first_touch (ht, pageaddr);
+         if (UNLIKELY(clo_firsttouching)) firsttouch_log (ht, pageaddr, (size & FT_WRITE_SIZE) != 0);
+         if (UNLIKELY(clo_listpages)) mapping_note (pageaddr);
       }
-      lastaddr = pageaddr;
-      lastpage = page;
+      cache->addr = pageaddr;
+      cache->page = page;
    }
-   page->count++;
-   page->last_access = (long) get_time();
+   const Time now = get_time();
+   // not in the WS, as in recently_used_pages(); purged pages (0) also within the first tau
+   const Time tmin = clo_tau < now ? now - clo_tau : 0;
+   const Bool entered = page->count == 0 || page->last_access <= tmin;
+   page->count += n;
+   page->last_access = (long) now;
 
    maybe_compute_ws();
+   return entered;
+}
+
+static
+inline void analyses_access(AccessKind kind, Addr addr, SizeT size)
+{
+   for (Int i = 0; i < n_hook_access; i++) hook_access[i]->access (kind, addr, size);
+}
+
+static
+inline void analyses_page_entered(AccessKind kind, Addr addr)
+{
+   for (Int i = 0; i < n_hook_page_entered; i++) hook_page_entered[i]->page_entered (kind, addr);
 }
 
 static
 VG_REGPARM(2) void trace_data(Addr addr, SizeT size)
 {
-   const Addr pa = pageaddr(addr);
-   pageaccess(pa, ht_data);
-   if (clo_localitytr) track_locality(&locality_data, addr);
+   pageaccess(pageaddr(addr), ht_data, &cache_data, &self_stats.data, 1, size);
 }
 
 static
 VG_REGPARM(2) void trace_instr(Addr addr, SizeT size)
 {
-   const Addr pa = pageaddr(addr);
-   pageaccess(pa, ht_insn);
-   if (clo_localitytr) track_locality(&locality_insn, addr);
+   pageaccess(pageaddr(addr), ht_insn, &cache_insn, &self_stats.insn, 1, size);
+}
+
+/* Variants for hot SBs, counting n accesses at once. See tier_access(). */
+static
+VG_REGPARM(2) void trace_data_n(Addr addr, SizeT n)
+{
+   pageaccess(pageaddr(addr), ht_data, &cache_data, &self_stats.data, n & ~FT_WRITE_SIZE, n);
+}
+
+static
+VG_REGPARM(2) void trace_instr_n(Addr addr, SizeT n)
+{
+   pageaccess(pageaddr(addr), ht_insn, &cache_insn, &self_stats.insn, n, 0);
+}
+
+/* Variants of the above with analysis hooks. Only used in instrumentation
+   if an enabled analysis has an access hook. */
+static
+VG_REGPARM(2) void trace_data_hooked(Addr addr, SizeT size)
+{
+   analyses_access(AccessData, addr, size & ~FT_WRITE_SIZE);
+   if (pageaccess(pageaddr(addr), ht_data, &cache_data, &self_stats.data, 1, size))
+      analyses_page_entered(AccessData, addr);
+}
+
+static
+VG_REGPARM(2) void trace_instr_hooked(Addr addr, SizeT size)
+{
+   analyses_access(AccessInsn, addr, size);
+   if (pageaccess(pageaddr(addr), ht_insn, &cache_insn, &self_stats.insn, 1, size))
+      analyses_page_entered(AccessInsn, addr);
+}
+
+/**
+ * @brief FT_WRITE_SIZE for writes with --ws-first-touch, to be or'ed into the
+ * size argument of the data helpers. Only pageaccess() decodes it, on insert.
+ */
+static
+SizeT ft_write_flag(const Event *ev)
+{
+   return clo_firsttouching && (ev->ekind == Event_Dw || ev->ekind == Event_Dm) ? FT_WRITE_SIZE : 0;
 }
 
 static
@@ -562,26 +1702,49 @@ void flushEvents(IRSB* sb)
    IRExpr**   argv;
    IRDirty*   di;
    Event*     ev;
+   const Bool hooked = n_hook_access > 0 || n_hook_page_entered > 0;
+   ULong      n_read = 0, n_written = 0, n_acc = 0;  // of unguarded events, see --ws-volume
 
    for (i = 0; i < events_used; i++) {
 
       ev = &events[i];
 
+      if (clo_volume && ev->ekind != Event_Ir) {
+         const Bool rd = ev->ekind != Event_Dw;
+         const Bool wr = ev->ekind != Event_Dr;  // modify is both
+         if (ev->guard) {
+            IRExpr *sz = IRExpr_ITE(ev->guard, IRExpr_Const(IRConst_U64(ev->size)),
+                                               IRExpr_Const(IRConst_U64(0)));
+            IRExpr *one = IRExpr_ITE(ev->guard, IRExpr_Const(IRConst_U64(1)),
+                                                IRExpr_Const(IRConst_U64(0)));
+            if (rd) add_counter(sb, &vol_read, sz);
+            if (wr) add_counter(sb, &vol_written, sz);
+            add_counter(sb, &vol_accesses, one);
+         } else {
+            if (rd) n_read += ev->size;
+            if (wr) n_written += ev->size;
+            n_acc++;
+         }
+      }
+
+      if (tier_hot) continue;  // see tier_flush()
+
       // Decide on helper fn to call and args to pass it.
       switch (ev->ekind) {
-         case Event_Ir: helperName = "trace_instr";
-                        helperAddr =  trace_instr;  break;
+         case Event_Ir: helperName = hooked ? "trace_instr_hooked" : "trace_instr";
+                        helperAddr = hooked ?  trace_instr_hooked :  trace_instr;  break;
 
          case Event_Dr:
          case Event_Dw:
-         case Event_Dm: helperName = "trace_data";
-                        helperAddr =  trace_data; break;
+         case Event_Dm: helperName = hooked ? "trace_data_hooked" : "trace_data";
+                        helperAddr = hooked ?  trace_data_hooked :  trace_data;
+                        break;
          default:
             tl_assert(0);
       }
 
       // Add the helper. FIXME: help the branch predictor here?
-      argv = mkIRExprVec_2( ev->addr, mkIRExpr_HWord( ev->size ));
+      argv = mkIRExprVec_2( ev->addr, mkIRExpr_HWord( ev->size | ft_write_flag (ev) ));
       di   = unsafeIRDirty_0_N( /*regparms*/2,
                                 helperName, VG_(fnptr_to_fnentry)( helperAddr ),
                                 argv );
@@ -591,6 +1754,13 @@ void flushEvents(IRSB* sb)
       addStmtToIRSB( sb, IRStmt_Dirty(di) );
    }
 
+   if (tier_hot) tier_flush(sb);
+
+   // one update per batch
+   if (n_read > 0)    add_counter(sb, &vol_read, IRExpr_Const(IRConst_U64(n_read)));
+   if (n_written > 0) add_counter(sb, &vol_written, IRExpr_Const(IRConst_U64(n_written)));
+   if (n_acc > 0)     add_counter(sb, &vol_accesses, IRExpr_Const(IRConst_U64(n_acc)));
+
    events_used = 0;
 }
 
@@ -600,6 +1770,7 @@ void addEvent_Ir ( IRSB* sb, IRAtom* iaddr, UInt isize )
    Event* evt;
    tl_assert( (VG_MIN_INSTR_SZB <= isize && isize <= VG_MAX_INSTR_SZB)
             || VG_CLREQ_SZB == isize );
+   if (clo_track == TrackData) return;
    if (events_used == N_EVENTS)
       flushEvents(sb);
    tl_assert(events_used >= 0 && events_used < N_EVENTS);
@@ -618,6 +1789,7 @@ void addEvent_Dr_guarded ( IRSB* sb, IRAtom* daddr, Int dsize, IRAtom* guard )
    Event* evt;
    tl_assert(isIRAtom(daddr));
    tl_assert(dsize >= 1 && dsize <= MAX_DSIZE);
+   if (clo_track == TrackInsn) return;
    if (events_used == N_EVENTS)
       flushEvents(sb);
    tl_assert(events_used >= 0 && events_used < N_EVENTS);
@@ -644,6 +1816,7 @@ void addEvent_Dw_guarded ( IRSB* sb, IRAtom* daddr, Int dsize, IRAtom* guard )
    Event* evt;
    tl_assert(isIRAtom(daddr));
    tl_assert(dsize >= 1 && dsize <= MAX_DSIZE);
+   if (clo_track == TrackInsn) return;
    if (events_used == N_EVENTS)
       flushEvents(sb);
    tl_assert(events_used >= 0 && events_used < N_EVENTS);
@@ -665,6 +1838,7 @@ void addEvent_Dw ( IRSB* sb, IRAtom* daddr, Int dsize )
    Event* evt;
    tl_assert(isIRAtom(daddr));
    tl_assert(dsize >= 1 && dsize <= MAX_DSIZE);
+   if (clo_track == TrackInsn) return;
 
    // Is it possible to merge this write with the preceding read?
    lastEvt = &events[events_used-1];
@@ -719,6 +1893,20 @@ void ws_post_clo_init(void)
                 TimeUnit_to_string(clo_time_unit));
       clo_time_unit = TimeI;
    }
+   if (clo_track == TrackInsn && (clo_heapfields || clo_stacks || clo_volume || clo_madvise)) {
+      VG_(umsg)("Warning: --ws-track=insn, analyses of data accesses will be empty\n");
+   }
+   if (clo_track == TrackData && clo_jit) {
+      VG_(umsg)("Warning: --ws-track=data, --ws-jit will be empty\n");
+   }
+   if (clo_window && clo_trace) {
+      VG_(fmsg_bad_option)("--ws-trace-file", "cannot be combined with --ws-start-at/--ws-stop-after\n");
+   }
+   if (clo_bulk && clo_trace) {
+      // the trace has one record per access, a range would be one record for many
+      VG_(umsg)("Warning: --ws-trace-file, ignoring --ws-bulk-ranges\n");
+      clo_bulk = False;
+   }
 
    // user list of times for sample info
    {
@@ -762,178 +1950,2763 @@ void ws_post_clo_init(void)
       }
    }
 
-   // peak filters
-   init_peakd(&pd_data);
-   init_peakd(&pd_insn);
+   analyses_init();
+   if (clo_listpages) mappings_init();
+
+   // inline page checks cannot call access hooks, and assume 64-bit addresses
+   if (clo_tiered > 0 && (n_hook_access > 0 || n_hook_page_entered > 0 || sizeof(HWord) != 8)) {
+      VG_(umsg)("Warning: --ws-tiered not possible with the enabled analyses or on this host\n");
+      clo_tiered = 0;
+   }
+   if (clo_tiered > 0) tier_init();
+   if (clo_window || clo_tiered > 0 || clo_jit)
+      VG_(track_start_client_code) (ws_start_client_code);
+
+   // verbose a bit
+   VG_(umsg)("Page size = %d bytes\n", clo_pagesize);
+   VG_(umsg)("Computing WS every %d %s\n", clo_every,
+             TimeUnit_to_string(clo_time_unit));
+   VG_(umsg)("Considering references in past %d %s\n", clo_tau,
+             TimeUnit_to_string(clo_time_unit));
+}
+
+static
+void analyses_sb_entered(void)
+{
+   SELF_STAT(self_stats.helper_sb++);
+   for (Int i = 0; i < n_hook_sb_entered; i++) hook_sb_entered[i]->sb_entered ();
+}
+
+static
+void analyses_sb_exited(void)
+{
+   SELF_STAT(self_stats.helper_sb++);
+   for (Int i = 0; i < n_hook_sb_exited; i++) hook_sb_exited[i]->sb_exited ();
+}
+
+/**
+ * @brief instruments SB to increment a 64-bit counter by the I64 expression n.
+ */
+static
+IRExpr* add_counter(IRSB* sbOut, void *counter, IRExpr *n)
+{
+   #if defined(VG_BIGENDIAN)
+      #define END Iend_BE
+   #elif defined(VG_LITTLEENDIAN)
+      #define END Iend_LE
+   #else
+      #error "Unknown endianness"
+   #endif
+   // Add code to increment '*counter' by 'n', like this:
+   //   WrTmp(t1, Load64(counter))
+   //   WrTmp(t2, Add64(RdTmp(t1), n))
+   //   Store(counter, t2)
+   IRTemp t1 = newIRTemp(sbOut->tyenv, Ity_I64);
+   IRTemp t2 = newIRTemp(sbOut->tyenv, Ity_I64);
+   IRExpr* counter_addr = mkIRExpr_HWord( (HWord)counter );
+
+   // keep IR flat
+   if (!isIRAtom(n)) {
+      IRTemp tn = newIRTemp(sbOut->tyenv, Ity_I64);
+      addStmtToIRSB( sbOut, IRStmt_WrTmp(tn, n) );
+      n = IRExpr_RdTmp(tn);
+   }
+
+   IRStmt* st1 = IRStmt_WrTmp(t1, IRExpr_Load(END, Ity_I64, counter_addr));
+   IRStmt* st2 = IRStmt_WrTmp(t2, IRExpr_Binop(Iop_Add64, IRExpr_RdTmp(t1), n));
+   IRStmt* st3 = IRStmt_Store(END, counter_addr, IRExpr_RdTmp(t2));
+
+   addStmtToIRSB( sbOut, st1 );
+   addStmtToIRSB( sbOut, st2 );
+   addStmtToIRSB( sbOut, st3 );
+   return IRExpr_RdTmp(t2);
+}
+
+/**
+ * @brief instruments SB with a counter that increments by n, and is saved
+ * into guest_instrs_executed.
+ */
+static
+void add_counter_update(IRSB* sbOut, Int n)
+{
+   add_counter(sbOut, &guest_instrs_executed, IRExpr_Const(IRConst_U64(n)));
+}
+
+/**
+ * @brief discard translations without accounting it to the client, see --ws-jit
+ */
+static
+void discard_own_translations(Addr addr, SizeT len, const HChar *who)
+{
+   discarding_own = True;
+   VG_(discard_translations_safely) (addr, len, who);
+   discarding_own = False;
+}
+
+/**
+ * @brief bind expression to a new temporary, to keep IR flat
+ */
+static
+IRExpr* tier_bind(IRSB* sb, IRType ty, IRExpr* e)
+{
+   IRTemp t = newIRTemp(sb->tyenv, ty);
+   addStmtToIRSB( sb, IRStmt_WrTmp(t, e) );
+   return IRExpr_RdTmp(t);
+}
+
+/**
+ * @brief execution counter of a cold SB. Counters are never moved or freed,
+ * since translations refer to them.
+ */
+static
+ULong* tier_counter_new(void)
+{
+   if (tier_nctr % TIER_CHUNK == 0) {
+      ULong *chunk = VG_(calloc) ("ws.tier_counters", TIER_CHUNK, sizeof(ULong));
+      VG_(addToXA) (tier_counters, &chunk);
+   }
+   ULong **chunk = VG_(indexXA) (tier_counters, tier_nctr / TIER_CHUNK);
+   return &(*chunk)[tier_nctr++ % TIER_CHUNK];
+}
+
+/**
+ * @brief SB became hot. It is re-translated after the next thread switch.
+ */
+static
+VG_REGPARM(2) void tier_promote(Addr addr, SizeT len)
+{
+   if (VG_(HT_lookup) (ht_hotsb, addr)) return;  // several translations of one SB
+   struct map_hotsb *hs = VG_(malloc) (sizeof(*hs));
+   hs->top.key = addr;
+   hs->len = len;
+   VG_(HT_add_node) (ht_hotsb, (VgHashNode *) hs);
+   VG_(addToXA) (tier_pending, &hs);
+}
+
+/**
+ * @brief cold SB: count executions, and promote it at --ws-tiered
+ */
+static
+void tier_count_sb(IRSB* sb, const VexGuestExtents* vge)
+{
+   ULong *ctr = tier_counter_new();
+   IRExpr *cnt = add_counter(sb, ctr, IRExpr_Const(IRConst_U64(1)));
+   IRExpr *hot = tier_bind(sb, Ity_I1, IRExpr_Binop(Iop_CmpEQ64, cnt,
+                                                    IRExpr_Const(IRConst_U64(clo_tiered))));
+   IRDirty *di = unsafeIRDirty_0_N( 2, "tier_promote", VG_(fnptr_to_fnentry)( &tier_promote ),
+                                    mkIRExprVec_2( mkIRExpr_HWord( vge->base[0] ),
+                                                   mkIRExpr_HWord( vge->len[0] ) ) );
+   di->guard = hot;
+   addStmtToIRSB( sb, IRStmt_Dirty(di) );
+}
+
+/**
+ * @brief helper of add_sample_check()
+ */
+static
+void sample_due(void)
+{
+   maybe_compute_ws();
+}
+
+/**
+ * @brief instruments SB with a check whether a sample is due, as pageaccess()
+ * would do. Needed where the instruction counter advances without page access
+ * helpers, i.e. under --ws-track=data and in vgpreload_ws; otherwise a sample
+ * would wait for the next data access, arbitrarily long.
+ */
+static
+void add_sample_check(IRSB* sb)
+{
+   IRExpr *now = tier_bind(sb, Ity_I64, IRExpr_Load(END, Ity_I64,
+                                                    mkIRExpr_HWord((HWord)&guest_instrs_executed)));
+   IRExpr *nxt = tier_bind(sb, Ity_I64, IRExpr_Load(END, Ity_I64,
+                                                    mkIRExpr_HWord((HWord)&next_sample_time)));
+   IRDirty *di = unsafeIRDirty_0_N( 0, "sample_due", VG_(fnptr_to_fnentry)( &sample_due ),
+                                    mkIRExprVec_0() );
+   di->guard = tier_bind(sb, Ity_I1, IRExpr_Binop(Iop_CmpLE64U, nxt, now));
+   addStmtToIRSB( sb, IRStmt_Dirty(di) );
+}
+
+/**
+ * @brief hot SB: n accesses to the page of addr. If the page is the one in the
+ * cache and no sample is due, count and time stamp are updated inline, like
+ * pageaccess() would do. Otherwise the helper is called.
+ */
+static
+void tier_access(IRSB* sb, IRExpr* addr, Bool insn, ULong n, SizeT flag)
+{
+   PageCache *cache = insn ? &cache_insn : &cache_data;
+   IRExpr *pg  = tier_bind(sb, Ity_I64, IRExpr_Binop(Iop_And64, addr,
+                                                     mkIRExpr_HWord(~(HWord)(clo_pagesize - 1))));
+   IRExpr *ca  = tier_bind(sb, Ity_I64, IRExpr_Load(END, Ity_I64, mkIRExpr_HWord((HWord)&cache->addr)));
+   IRExpr *now = tier_bind(sb, Ity_I64, IRExpr_Load(END, Ity_I64,
+                                                    mkIRExpr_HWord((HWord)&guest_instrs_executed)));
+   IRExpr *nxt = tier_bind(sb, Ity_I64, IRExpr_Load(END, Ity_I64,
+                                                    mkIRExpr_HWord((HWord)&next_sample_time)));
+   IRExpr *eq  = tier_bind(sb, Ity_I1, IRExpr_Binop(Iop_CmpEQ64, pg, ca));
+   IRExpr *due = tier_bind(sb, Ity_I1, IRExpr_Binop(Iop_CmpLT64U, now, nxt));
+   IRExpr *both = tier_bind(sb, Ity_I64, IRExpr_Binop(Iop_And64,
+                               tier_bind(sb, Ity_I64, IRExpr_Unop(Iop_1Uto64, eq)),
+                               tier_bind(sb, Ity_I64, IRExpr_Unop(Iop_1Uto64, due))));
+   IRExpr *hit  = tier_bind(sb, Ity_I1, IRExpr_Binop(Iop_CmpNE64, both,
+                                                     IRExpr_Const(IRConst_U64(0))));
+   IRExpr *miss = tier_bind(sb, Ity_I1, IRExpr_Unop(Iop_Not1, hit));
+
+   // the cache always points to a valid page, so loads are safe on a miss
+   IRExpr *pp  = tier_bind(sb, Ity_I64, IRExpr_Load(END, Ity_I64, mkIRExpr_HWord((HWord)&cache->page)));
+   IRExpr *pc  = tier_bind(sb, Ity_I64, IRExpr_Binop(Iop_Add64, pp,
+                    mkIRExpr_HWord(offsetof(struct map_pageaddr, count))));
+   IRExpr *cnt = tier_bind(sb, Ity_I64, IRExpr_Load(END, Ity_I64, pc));
+   IRExpr *cn  = tier_bind(sb, Ity_I64, IRExpr_Binop(Iop_Add64, cnt, IRExpr_Const(IRConst_U64(n))));
+   addStmtToIRSB( sb, IRStmt_StoreG(END, pc, cn, hit) );
+   IRExpr *pl  = tier_bind(sb, Ity_I64, IRExpr_Binop(Iop_Add64, pp,
+                    mkIRExpr_HWord(offsetof(struct map_pageaddr, last_access))));
+   addStmtToIRSB( sb, IRStmt_StoreG(END, pl, now, hit) );
+
+   IRDirty *di = unsafeIRDirty_0_N( 2, insn ? "trace_instr_n" : "trace_data_n",
+                                    VG_(fnptr_to_fnentry)( insn ? trace_instr_n : trace_data_n ),
+                                    mkIRExprVec_2( addr, mkIRExpr_HWord( n | flag ) ) );
+   di->guard = miss;
+   addStmtToIRSB( sb, IRStmt_Dirty(di) );
+}
+
+/**
+ * @brief events of a hot SB. The batches are the same as in cold SBs, and no
+ * counter update is emitted within a batch, so the cold helpers would see the
+ * same time for all of its events. Hence accesses to the same page can be
+ * counted at once, at the position of the first one: fetches on the same page,
+ * and data accesses with the same address expression. Time stamps and samples
+ * remain the same as in cold SBs.
+ */
+static
+void tier_flush(IRSB* sb)
+{
+   Int   first[N_EVENTS];
+   ULong n[N_EVENTS];
+
+   for (Int i = 0; i < events_used; i++) {
+      const Event *ev = &events[i];
+      first[i] = i;
+      n[i] = 0;
+      if (ev->guard) continue;
+      for (Int j = 0; j < i; j++) {
+         const Event *ej = &events[j];
+         if (ej->guard || first[j] != j || (ej->ekind == Event_Ir) != (ev->ekind == Event_Ir))
+            continue;
+         const Bool same = ev->ekind == Event_Ir
+            ? pageaddr(ev->addr->Iex.Const.con->Ico.U64) == pageaddr(ej->addr->Iex.Const.con->Ico.U64)
+            : eqIRAtom(ev->addr, ej->addr);
+         if (same) {
+            first[i] = j;
+            break;
+         }
+      }
+      n[first[i]]++;
+   }
+
+   for (Int i = 0; i < events_used; i++) {
+      const Event *ev = &events[i];
+      if (ev->guard) {
+         IRDirty *di = unsafeIRDirty_0_N( 2, "trace_data_n", VG_(fnptr_to_fnentry)( trace_data_n ),
+                                          mkIRExprVec_2( ev->addr,
+                                                         mkIRExpr_HWord( 1 | ft_write_flag (ev) ) ) );
+         di->guard = ev->guard;
+         addStmtToIRSB( sb, IRStmt_Dirty(di) );
+      } else if (first[i] == i) {
+         tier_access (sb, ev->addr, ev->ekind == Event_Ir, n[i], ft_write_flag (ev));
+      }
+   }
+}
+
+/**
+ * @brief discard translations of SBs promoted since the last thread switch
+ */
+static
+void tier_check(void)
+{
+   const Word num = VG_(sizeXA) (tier_pending);
+   for (Word i = 0; i < num; i++) {
+      const struct map_hotsb *hs = *(struct map_hotsb **) VG_(indexXA) (tier_pending, i);
+      discard_own_translations (hs->top.key, hs->len, "ws.tier_promote");
+   }
+   self_stats.tier_promoted += num;
+   VG_(dropTailXA) (tier_pending, num);
+}
+
+static
+void tier_init(void)
+{
+   ht_hotsb = VG_(HT_construct) ("ht_hotsb");
+   tier_pending = VG_(newXA) (VG_(malloc), "arr_tierpend", VG_(free), sizeof(struct map_hotsb*));
+   tier_counters = VG_(newXA) (VG_(malloc), "arr_tierctr", VG_(free), sizeof(ULong*));
+}
+
+static
+void tier_destroy(void)
+{
+   for (Int i = 0; i < VG_(sizeXA) (tier_counters); i++) {
+      VG_(free) (*(ULong **) VG_(indexXA) (tier_counters, i));
+   }
+   VG_(deleteXA) (tier_counters);
+   VG_(deleteXA) (tier_pending);
+   VG_(HT_destruct) (ht_hotsb, VG_(free));
+}
+
+// iterate pages and count those accessed within (now_time - tau, now_time)
+static
+unsigned long recently_used_pages(VgHashTable *ht, TableStats *st, Time now_time)
+{
+   unsigned long cnt = 0;
+
+   Time tmin = 0;
+   if (clo_tau < now_time) tmin = now_time - clo_tau;
+
+   VG_(HT_ResetIter)(ht);
+   const VgHashNode *nd;
+   while ((nd = VG_(HT_Next)(ht))) {
+      const struct map_pageaddr *page = (const struct map_pageaddr *) nd;
+      if (page->last_access > tmin) cnt++;
+   }
+   SELF_STAT(st->scan_nodes += VG_(HT_count_nodes) (ht));
+   return cnt;
+}
+
+/**
+ * @brief actually assemble callstack string
+ * * XXX: do not change this function without according changes in strstack_maxlen()
+ */
+static
+void strstack_make
+(UInt n, DiEpoch ep, Addr ip, void* uu_opaque)
+{
+   callstack_string *cs = (callstack_string*) uu_opaque;
+
+   // inlining
+   InlIPCursor *iipc = VG_(new_IIPC)(ep, ip);
+   do {
+      const HChar *fname;
+      UInt         line;
+      if (VG_(get_filename_linenum)(ep, ip, &fname, NULL, &line)) {
+         // format: "%s:%u"
+         VG_(strncat) (cs->str, fname, cs->rem); cs->rem -= VG_(strlen)(fname);
+         VG_(strncat) (cs->str, ":", cs->rem); cs->rem -= 1;
+         cs->rem -= VG_(snprintf) (cs->str + VG_(strlen) (cs->str), cs->rem, "%u", line);
+      }
+      // separator
+      VG_(strncat) (cs->str, "|", cs->rem); cs->rem -= 1;
+   } while (VG_(next_IIPC)(iipc));
+}
+
+/**
+ * @brief determine max. length of callstack string
+ * XXX: do not change this function without according changes in strstack_make()
+ */
+static
+void strstack_maxlen(UInt n, DiEpoch ep, Addr ip, void* uu_opaque)
+{
+   callstack_string *cs = (callstack_string*) uu_opaque;
+
+   // inlining
+   InlIPCursor *iipc = VG_(new_IIPC)(ep, ip);
+   do {
+      const HChar *fname;
+      UInt         line;
+      if (VG_(get_filename_linenum)(ep, ip, &fname, NULL, &line)) {
+         // format: "%s:%u"
+         HChar buf[8];
+         cs->rem += VG_(strlen) (fname);
+         cs->rem += 1;
+         cs->rem += VG_(snprintf) (buf, sizeof(buf), "%u", line);
+      }
+      cs->rem += 1;  // trailing separator or NULL terminator.
+   } while (VG_(next_IIPC)(iipc));
+   VG_(delete_IIPC)(iipc);
+}
+
+/**
+ * @brief get callstack as string
+ */
+static
+HChar* get_callstack(ExeContext *ec)
+{
+   callstack_string cs;
+   const DiEpoch ep = VG_(get_ExeContext_epoch) (ec);
+
+   // pre-calculate length of string
+   cs.rem = 0;
+   VG_(apply_ExeContext) (strstack_maxlen, (void*)&cs, ep, ec);
+
+   cs.rem += 1; // better than sorry
+   cs.str = (HChar*) VG_(malloc) (cs.rem * sizeof(HChar));
+   cs.str[0] = 0;
+
+   // assemble string
+   VG_(apply_ExeContext) (strstack_make, (void*)&cs, ep, ec);
+   cs.str[VG_(strlen) (cs.str) - 1] = 0;  // remove trailing separator
+
+   return cs.str;
+}
+
+/**
+ * @brief append a zeroed sample taken at time t
+ */
+static
+WorkingSet* samples_add(SampleStore *ss, Time t)
+{
+   if (ss->num % SAMPLES_PER_CHUNK == 0) {
+      WorkingSet *chunk = VG_(malloc) (SAMPLES_PER_CHUNK * sizeof(WorkingSet));
+      VG_(addToXA) (ss->chunks, &chunk);
+   }
+   WorkingSet **chunk = VG_(indexXA) (ss->chunks, ss->num / SAMPLES_PER_CHUNK);
+   WorkingSet *ws = &(*chunk)[ss->num % SAMPLES_PER_CHUNK];
+   VG_(memset) (ws, 0, sizeof(*ws));
+
+   const Time intended = ss->num > 0 ? ss->last_t + clo_every : ss->first_t;
+   const Long dt = (Long) t - (Long) intended;
+   // overshoot is at most one SB (see add_sample_check), undershoot at most --ws-every
+   tl_assert(dt == (Int) dt);
+   ws->dt = (Int) dt;
+   ss->last_t = t;
+   ss->num++;
+   return ws;
+}
+
+/**
+ * @brief next sample and its time, or NULL at the end
+ */
+static
+WorkingSet* samples_next(const SampleStore *ss, SampleIter *it, Time *t)
+{
+   if (it->i >= ss->num) return NULL;
+   WorkingSet **chunk = VG_(indexXA) (ss->chunks, it->i / SAMPLES_PER_CHUNK);
+   WorkingSet *ws = &(*chunk)[it->i % SAMPLES_PER_CHUNK];
+   it->t = (it->i > 0 ? it->t + clo_every : ss->first_t) + ws->dt;
+   it->i++;
+   *t = it->t;
+   return ws;
+}
+
+static
+void samples_init(SampleStore *ss)
+{
+   ss->chunks = VG_(newXA) (VG_(malloc), "arr_ws", VG_(free), sizeof(WorkingSet*));
+   ss->num = 0;
+   ss->first_t = 0;
+   ss->last_t = 0;
+}
+
+static
+void samples_destroy(SampleStore *ss)
+{
+   for (Int i = 0; i < VG_(sizeXA) (ss->chunks); i++) {
+      VG_(free) (*(WorkingSet **) VG_(indexXA) (ss->chunks, i));
+   }
+   VG_(deleteXA) (ss->chunks);
+   ss->num = 0;
+}
+
+/**
+ * @brief record additional information about process right now, for the latest sample.
+ * The running thread comes first; with --ws-info-threads=yes, all other live
+ * threads follow.
+ */
+static
+void record_sample_info(void)
+{
+   SampleContext sc;
+   sc.sample = ws_at_time.num - 1;
+   sc.entries = 0;
+   if (postmortem) {
+      sc.tid = VG_INVALID_THREADID;
+      sc.ec = VG_(null_ExeContext)();
+      VG_(addToXA) (ws_context_list, &sc);
+      return;
+   }
+
+   const ThreadId running = VG_(get_running_tid)();
+   sc.tid = running;
+   if (clo_infothreads) sc.entries = thread_entries[running];
+   sc.ec = VG_(record_ExeContext)(running, 0);
+   VG_(addToXA) (ws_context_list, &sc);
+
+   if (clo_infothreads) {
+      ThreadId tid;
+      Addr stack_min, stack_max;
+      VG_(thread_stack_reset_iter) (&tid);
+      while (VG_(thread_stack_next) (&tid, &stack_min, &stack_max)) {
+         if (tid == running) continue;
+         sc.tid = tid;
+         sc.entries = thread_entries[tid];
+         sc.ec = VG_(record_ExeContext)(tid, 0);
+         VG_(addToXA) (ws_context_list, &sc);
+      }
+      VG_(memset) (thread_entries, 0, VG_N_THREADS * sizeof(thread_entries[0]));
+   }
+}
+
+static
+void peaks_init(void)
+{
+   init_peakd(&pd_data);
+   init_peakd(&pd_insn);
+}
+
+static
+void peaks_sample(Time t, WorkingSet *ws, Bool *have_info)
+{
+   // both peak detect have to run every sample for uniformity, thus no short-circuit eval
+   const Bool pk_data = peak_detect(&pd_data, ws->pages_data);
+   const Bool pk_insn = peak_detect(&pd_insn, ws->pages_insn);
+   if (!*have_info && (pk_data || pk_insn)) {
+      record_sample_info ();
+      *have_info = True;
+   }
+   #ifdef DEBUG
+      ws->mAvg = pd_data.movingAvg;
+      ws->mVar = pd_data.movingVar;
+   #endif
+}
+
+static
+void threads_init(void)
+{
+   thread_entries = VG_(calloc) ("ws.thread_entries", VG_N_THREADS, sizeof(thread_entries[0]));
+}
+
+static
+void threads_page_entered(AccessKind kind, Addr addr)
+{
+   const ThreadId tid = VG_(get_running_tid)();
+   if (tid < VG_N_THREADS) thread_entries[tid]++;
+}
+
+/**
+ * @brief stacks of all threads at each info point (after compute_sample_info())
+ */
+static
+void print_thread_stacks(VgFile *fp)
+{
+   VG_(fprintf) (fp, "%12s %4s %8s %4s", "t", "tid", "entries", "info");
+   SampleIter it = { 0, 0 };
+   Time t = 0;
+   const int n_info = VG_(sizeXA) (ws_context_list);
+   for (int i = 0; i < n_info; i++) {
+      const SampleContext *sc = VG_(indexXA) (ws_context_list, i);
+      while (it.i <= sc->sample && samples_next(&ws_at_time, &it, &t)) {}
+      const UInt ecid = VG_(get_ECU_from_ExeContext)(sc->ec);
+      const struct map_context2sampleinfo *pki = VG_(HT_lookup) (ht_ec2sampleinfo, ecid);
+      tl_assert(pki != NULL);
+      VG_(fprintf) (fp, "\n%12lu %4u %8u %4u", (unsigned long) t, sc->tid, sc->entries,
+                    pki->info.id);
+   }
+}
+
+static
+void heap_init(void)
+{
+   heap_blocks  = VG_(newFM) (VG_(malloc), "ws.heap_blocks", VG_(free), NULL);
+   ht_heap      = VG_(HT_construct) ("ht_heap");
+   ht_heapsites = VG_(HT_construct) ("ht_heapsites");
+   heap_samples = VG_(newXA) (VG_(malloc), "arr_heap", VG_(free), sizeof(HeapSample));
+}
+
+/**
+ * @brief field heat of an allocation site, created on first use
+ */
+static
+struct map_heapfields* fields_site(ExeContext *where)
+{
+   const UInt ecu = VG_(get_ECU_from_ExeContext) (where);
+   struct map_heapfields *site = VG_(HT_lookup) (ht_heapfields, ecu);
+   if (site == NULL) {
+      site = VG_(calloc) ("ws.heapfields", 1, sizeof(*site));
+      site->top.key = ecu;
+      site->where = where;
+      VG_(HT_add_node) (ht_heapfields, (VgHashNode *) site);
+   }
+   return site;
+}
+
+/**
+ * @brief add lines used by a block to its site, when it is freed or at the end
+ */
+static
+void fields_retire(const HeapBlock *b)
+{
+   struct map_heapfields *site = b->fields;
+   site->blocks++;
+   site->lines_used += __builtin_popcountll (b->touched);
+   site->lines_total += (b->size + HEAP_LINE_SIZE - 1) / HEAP_LINE_SIZE;
+}
+
+/**
+ * @brief add or remove the bytes of a block to the pages it spans
+ */
+static
+void heap_account(Addr a, SizeT size, Bool add)
+{
+   const Addr end = a + size;
+   for (Addr pg = pageaddr(a); pg < end; pg += clo_pagesize) {
+      const Addr lo = pg > a ? pg : a;
+      const Addr hi = end < pg + clo_pagesize ? end : pg + clo_pagesize;
+      struct map_heappage *hp = VG_(HT_lookup) (ht_heap, pg);
+      if (add) {
+         if (hp == NULL) {
+            hp = VG_(malloc) (sizeof(*hp));
+            hp->top.key = pg;
+            hp->live = 0;
+            VG_(HT_add_node) (ht_heap, (VgHashNode *) hp);
+         }
+         hp->live += hi - lo;
+      } else if (hp != NULL) {
+         hp->live -= (hi - lo < hp->live) ? hi - lo : hp->live;
+         if (hp->live == 0) VG_(free) (VG_(HT_remove) (ht_heap, pg));
+      }
+   }
+}
+
+static
+void heap_free(Addr a)
+{
+   UWord k, v;
+   if (!VG_(delFromFM) (heap_blocks, &k, &v, a)) return;  // not from a wrapped allocator
+   HeapBlock *b = (HeapBlock *) v;
+   heap_account (b->start, b->size, False);
+   if (b->fields) fields_retire (b);
+   if (b == heap_last_block) heap_last_block = NULL;
+   VG_(free) (b);
+}
+
+static
+void heap_alloc(ThreadId tid, Addr a, SizeT size)
+{
+   heap_free (a);  // e.g., realloc in place
+   HeapBlock *b = VG_(malloc) (sizeof(*b));
+   b->start = a;
+   b->size = size;
+   b->where = VG_(record_ExeContext) (tid, 0);
+   b->fields = clo_heapfields ? fields_site (b->where) : NULL;
+   b->touched = 0;
+   VG_(addToFM) (heap_blocks, a, (UWord) b);
+   heap_account (a, size, True);
+}
+
+/**
+ * @brief charge the allocation site of a block for the sparse page pg
+ */
+static
+void heap_blame(const HeapBlock *b, Addr pg)
+{
+   const Addr end = b->start + b->size;
+   const Addr lo = b->start > pg ? b->start : pg;
+   const Addr hi = end < pg + clo_pagesize ? end : pg + clo_pagesize;
+   if (hi <= lo) return;  // block ends before this page
+
+   const UInt ecu = VG_(get_ECU_from_ExeContext) (b->where);
+   struct map_heapsite *site = VG_(HT_lookup) (ht_heapsites, ecu);
+   if (site == NULL) {
+      site = VG_(calloc) ("ws.heapsite", 1, sizeof(*site));
+      site->top.key = ecu;
+      site->where = b->where;
+      VG_(HT_add_node) (ht_heapsites, (VgHashNode *) site);
+   }
+   if (site->visit != heap_visit) {
+      site->visit = heap_visit;
+      site->pages++;
+   }
+   site->bytes += hi - lo;
+}
+
+/**
+ * @brief charge all blocks overlapping the sparse page pg
+ */
+static
+void heap_blame_sparse(Addr pg)
+{
+   UWord k, v;
+   heap_visit++;
+   // a block starting below the page may reach into it
+   if (!VG_(lookupFM) (heap_blocks, &k, &v, pg) &&
+       VG_(findBoundsFM) (heap_blocks, &k, &v, NULL, NULL, 0, 0, ~(UWord) 0, 0, pg) && v) {
+      heap_blame ((const HeapBlock *) v, pg);
+   }
+   VG_(initIterAtFM) (heap_blocks, pg);
+   while (VG_(nextIterFM) (heap_blocks, &k, &v) && k < pg + clo_pagesize) {
+      heap_blame ((const HeapBlock *) v, pg);
+   }
+   VG_(doneIterFM) (heap_blocks);
+}
+
+/**
+ * @brief live block containing addr, or NULL
+ */
+static
+const HeapBlock* heap_find(Addr addr)
+{
+   const HeapBlock *b = heap_last_block;
+   if (b && addr >= b->start && addr < b->start + b->size) return b;
+
+   UWord k, v;
+   if (!VG_(lookupFM) (heap_blocks, &k, &v, addr) &&
+       !VG_(findBoundsFM) (heap_blocks, &k, &v, NULL, NULL, 0, 0, ~(UWord) 0, 0, addr)) {
+      return NULL;
+   }
+   b = (const HeapBlock *) v;
+   if (b == NULL || addr >= b->start + b->size) return NULL;
+   heap_last_block = b;
+   return b;
+}
+
+static
+void fields_init(void)
+{
+   ht_heapfields = VG_(HT_construct) ("ht_heapfields");
+   fields_hist_sites = VG_(calloc) ("ws.fields_hist_sites", HEAP_FIELD_SLOTS,
+                                    sizeof(fields_hist_sites[0]));
+}
+
+/**
+ * @brief give a site a line histogram if it is among the top sites by WS entries.
+ * Only HEAP_FIELD_SLOTS sites have one; a site which overtakes the weakest of them
+ * takes over its histogram, which then starts from zero.
+ */
+static
+void fields_promote(struct map_heapfields *site)
+{
+   if (fields_hist_n < HEAP_FIELD_SLOTS) {
+      site->hist = VG_(calloc) ("ws.fields_hist", HEAP_FIELD_LINES + 1, sizeof(ULong));
+      fields_hist_sites[fields_hist_n++] = site;
+      return;
+   }
+   Int min = 0;
+   for (Int i = 1; i < HEAP_FIELD_SLOTS; i++) {
+      if (fields_hist_sites[i]->entries < fields_hist_sites[min]->entries) min = i;
+   }
+   struct map_heapfields *weak = fields_hist_sites[min];
+   if (site->entries <= weak->entries) return;
+   site->hist = weak->hist;
+   site->hist_accesses = 0;
+   VG_(memset) (site->hist, 0, (HEAP_FIELD_LINES + 1) * sizeof(ULong));
+   weak->hist = NULL;
+   weak->hist_accesses = 0;
+   fields_hist_sites[min] = site;
+}
+
+static
+void fields_access(AccessKind kind, Addr addr, SizeT size)
+{
+   if (kind != AccessData) return;
+   HeapBlock *b = (HeapBlock *) heap_find (addr);
+   if (b == NULL) return;
+   UWord line = (addr - b->start) / HEAP_LINE_SIZE;
+   if (line > HEAP_FIELD_LINES) line = HEAP_FIELD_LINES;
+   b->fields->accesses++;
+   if (b->fields->hist) {
+      b->fields->hist[line]++;
+      b->fields->hist_accesses++;
+   }
+   b->touched |= 1ULL << (line < HEAP_FIELD_LINES ? line : HEAP_FIELD_LINES - 1);
+}
+
+static
+void fields_page_entered(AccessKind kind, Addr addr)
+{
+   if (kind != AccessData) return;
+   const HeapBlock *b = heap_find (addr);
+   if (b == NULL) return;
+   b->fields->entries++;
+   if (b->fields->hist == NULL) fields_promote (b->fields);
+}
+
+static
+void fields_fini(void)
+{
+   UWord k, v;
+   VG_(initIterFM) (heap_blocks);
+   while (VG_(nextIterFM) (heap_blocks, &k, &v)) fields_retire ((const HeapBlock *) v);
+   VG_(doneIterFM) (heap_blocks);
+}
+
+/**
+ * @brief sort allocation sites by WS entries
+ */
+static
+Int map_heapfields_compare (const void *p1, const void *p2)
+{
+   const struct map_heapfields * const *a1 = (const struct map_heapfields * const *) p1;
+   const struct map_heapfields * const *a2 = (const struct map_heapfields * const *) p2;
+
+   if ((*a1)->entries > (*a2)->entries) return -1;
+   if ((*a1)->entries < (*a2)->entries) return 1;
+   return 0;
+}
+
+/**
+ * @brief accessed lines of the top allocation sites. Hot lines ('*') are
+ * the fewest lines which together make up 90% of the accesses in the histogram.
+ */
+static
+void print_heap_fields(VgFile *fp)
+{
+   const int nentry = VG_(HT_count_nodes) (ht_heapfields);
+   struct map_heapfields **res = VG_(malloc) ((nentry + 1) * sizeof (*res));
+   int nres = 0;
+   VG_(HT_ResetIter) (ht_heapfields);
+   VgHashNode *nd;
+   while ((nd = VG_(HT_Next) (ht_heapfields)))
+      res[nres++] = (struct map_heapfields *) nd;
+   VG_(ssort) (res, nres, sizeof (res[0]), map_heapfields_compare);
+
+   VG_(fprintf) (fp, "%'d allocation sites, top %d by WS entries:", nres, clo_heapfields_top);
+   for (int i = 0; i < nres && i < clo_heapfields_top; i++) {
+      const struct map_heapfields *site = res[i];
+      HChar *where = get_callstack (site->where);
+      VG_(fprintf) (fp, "\n[%4d] entries=%llu, accesses=%llu, blocks=%llu, "
+                    "lines used/allocated=%.1f/%.1f, loc=%s\n",
+                    i, site->entries, site->accesses, site->blocks,
+                    site->blocks ? (Float) site->lines_used / site->blocks : 0.f,
+                    site->blocks ? (Float) site->lines_total / site->blocks : 0.f, where);
+      VG_(free) (where);
+      if (site->hist == NULL) {
+         VG_(fprintf) (fp, "(no line histogram, not among the top %d sites)", HEAP_FIELD_SLOTS);
+         continue;
+      }
+      if (site->hist_accesses < site->accesses) {
+         VG_(fprintf) (fp, "(histogram of the last %'llu accesses)\n", site->hist_accesses);
+      }
+
+      // mark hot lines, most accessed first
+      Bool hot[HEAP_FIELD_LINES + 1];
+      VG_(memset) (hot, 0, sizeof(hot));
+      ULong covered = 0;
+      while (covered * 10 < site->hist_accesses * 9) {
+         Int max = -1;
+         for (Int l = 0; l <= HEAP_FIELD_LINES; l++) {
+            if (!hot[l] && site->hist[l] > 0 && (max < 0 || site->hist[l] > site->hist[max])) max = l;
+         }
+         if (max < 0) break;
+         hot[max] = True;
+         covered += site->hist[max];
+      }
+
+      VG_(fprintf) (fp, "%10s %14s %6s", "offset", "accesses", "share");
+      for (Int l = 0; l <= HEAP_FIELD_LINES; l++) {
+         if (site->hist[l] == 0) continue;
+         HChar off[16];
+         VG_(snprintf) (off, sizeof(off), "%s%d", l < HEAP_FIELD_LINES ? "" : ">=",
+                        l * HEAP_LINE_SIZE);
+         VG_(fprintf) (fp, "\n%10s %14llu %5u%% %s", off, site->hist[l],
+                       percent(site->hist[l], site->hist_accesses), hot[l] ? "*" : "");
+      }
+   }
+   VG_(free) (res);
+}
+
+static
+void heap_sample(Time t, WorkingSet *ws, Bool *have_info)
+{
+   HeapSample hs;
+   VG_(memset) (&hs, 0, sizeof(hs));
+   Time tmin = 0;
+   if (clo_tau < t) tmin = t - clo_tau;
+
+   VG_(HT_ResetIter) (ht_heap);
+   const VgHashNode *nd;
+   while ((nd = VG_(HT_Next) (ht_heap))) {
+      const struct map_heappage *hp = (const struct map_heappage *) nd;
+      const struct map_pageaddr *page = VG_(HT_lookup) (ht_data, hp->top.key);
+      if (page == NULL || page->last_access <= tmin) continue;  // not in WS
+      UInt bin = (UInt) (hp->live * HEAP_OCC_BINS / clo_pagesize);
+      if (bin >= HEAP_OCC_BINS) bin = HEAP_OCC_BINS - 1;
+      hs.pages++;
+      hs.live += hp->live;
+      hs.occ[bin]++;
+      if (bin == 0) heap_blame_sparse (hp->top.key);
+   }
+   VG_(addToXA) (heap_samples, &hs);
+}
+
+static
+void heap_header(VgFile *fp)
+{
+   VG_(fprintf) (fp, " %8s %10s", "WSS_heap", "live_kB");
+   for (Int b = 0; b < HEAP_OCC_BINS; b++) {
+      VG_(fprintf) (fp, " %6s%d", "occ", 100 * (b + 1) / HEAP_OCC_BINS);
+   }
+}
+
+static
+void heap_row(VgFile *fp, UInt sample)
+{
+   const HeapSample *hs = VG_(indexXA) (heap_samples, sample);
+   VG_(fprintf) (fp, " %8u %10llu", hs->pages, hs->live / 1024);
+   for (Int b = 0; b < HEAP_OCC_BINS; b++) {
+      VG_(fprintf) (fp, " %*u", b + 1 < HEAP_OCC_BINS ? 8 : 9, hs->occ[b]);
+   }
+}
+
+/**
+ * @brief sort allocation sites by sparse pages
+ */
+static
+Int map_heapsite_compare (const void *p1, const void *p2)
+{
+   const struct map_heapsite * const *a1 = (const struct map_heapsite * const *) p1;
+   const struct map_heapsite * const *a2 = (const struct map_heapsite * const *) p2;
+
+   if ((*a1)->pages > (*a2)->pages) return -1;
+   if ((*a1)->pages < (*a2)->pages) return 1;
+   return 0;
+}
+
+#define HEAP_TOP_SITES 20
+
+/**
+ * @brief allocation sites with blocks on sparsely occupied WS pages
+ */
+static
+void print_heap_sites(VgFile *fp)
+{
+   const int nentry = VG_(HT_count_nodes) (ht_heapsites);
+   struct map_heapsite **res = VG_(malloc) ((nentry + 1) * sizeof (*res));
+   int nres = 0;
+   VG_(HT_ResetIter) (ht_heapsites);
+   VgHashNode *nd;
+   while ((nd = VG_(HT_Next) (ht_heapsites)))
+      res[nres++] = (struct map_heapsite *) nd;
+   VG_(ssort) (res, nres, sizeof (res[0]), map_heapsite_compare);
+
+   VG_(fprintf) (fp, "%12s %14s %s", "page-samples", "bytes", "location");
+   for (int i = 0; i < nres && i < HEAP_TOP_SITES; i++) {
+      HChar *where = get_callstack (res[i]->where);
+      VG_(fprintf) (fp, "\n%12llu %14llu %s", res[i]->pages, res[i]->bytes, where);
+      VG_(free) (where);
+   }
+   if (nres > HEAP_TOP_SITES) {
+      VG_(fprintf) (fp, "\n(%'d more sites)", nres - HEAP_TOP_SITES);
+   }
+   VG_(free) (res);
+}
+
+static
+void heap_free_block(UWord b)
+{
+   VG_(free) ((HeapBlock *) b);
+}
+
+static
+void heap_destroy(void)
+{
+   VG_(deleteFM) (heap_blocks, NULL, heap_free_block);
+   VG_(HT_destruct) (ht_heap, VG_(free));
+   VG_(HT_destruct) (ht_heapsites, VG_(free));
+   VG_(deleteXA) (heap_samples);
+   if (clo_heapfields) {
+      for (Int i = 0; i < fields_hist_n; i++) {
+         if (fields_hist_sites[i]->hist) VG_(free) (fields_hist_sites[i]->hist);
+      }
+      VG_(free) (fields_hist_sites);
+      VG_(HT_destruct) (ht_heapfields, VG_(free));
+   }
+}
+
+static
+void pools_init(void)
+{
+   ht_pools     = VG_(HT_construct) ("ht_pools");
+   ht_poolpages = VG_(HT_construct) ("ht_poolpages");
+   ht_poolsites = VG_(HT_construct) ("ht_poolsites");
+   pool_chunks  = VG_(newFM) (VG_(malloc), "ws.pool_chunks", VG_(free), NULL);
+   pool_samples = VG_(newXA) (VG_(malloc), "arr_pools", VG_(free), sizeof(pagecount));
+}
+
+/**
+ * @brief after the owner of page pp is gone: take pool and site from the
+ * latest live chunk on it
+ */
+static
+void pool_page_owner(struct map_poolpage *pp)
+{
+   const Addr pg = pp->top.key;
+   const PoolChunk *owner = NULL;
+   UWord k, v;
+   // a chunk starting below the page may reach into it
+   if (!VG_(lookupFM) (pool_chunks, &k, &v, pg) &&
+       VG_(findBoundsFM) (pool_chunks, &k, &v, NULL, NULL, 0, 0, ~(UWord) 0, 0, pg) && v) {
+      const PoolChunk *c = (const PoolChunk *) v;
+      if (c->start + c->size > pg) owner = c;
+   }
+   VG_(initIterAtFM) (pool_chunks, pg);
+   while (VG_(nextIterFM) (pool_chunks, &k, &v) && k < pg + clo_pagesize) {
+      const PoolChunk *c = (const PoolChunk *) v;
+      if (owner == NULL || c->seq > owner->seq) owner = c;
+   }
+   VG_(doneIterFM) (pool_chunks);
+   if (owner == NULL) return;
+   pp->pool = owner->pool;
+   pp->where = owner->where;
+   pp->seq = owner->seq;
+}
+
+/**
+ * @brief like heap_account(), for pool chunks. When removing, c must no longer
+ * be in pool_chunks.
+ */
+static
+void pool_account(const PoolChunk *c, Bool add)
+{
+   const Addr end = c->start + c->size;
+   for (Addr pg = pageaddr(c->start); pg < end; pg += clo_pagesize) {
+      const Addr lo = pg > c->start ? pg : c->start;
+      const Addr hi = end < pg + clo_pagesize ? end : pg + clo_pagesize;
+      struct map_poolpage *pp = VG_(HT_lookup) (ht_poolpages, pg);
+      if (add) {
+         if (pp == NULL) {
+            pp = VG_(malloc) (sizeof(*pp));
+            pp->top.key = pg;
+            pp->live = 0;
+            pp->seq = 0;
+            VG_(HT_add_node) (ht_poolpages, (VgHashNode *) pp);
+         }
+         pp->live += hi - lo;
+         if (c->seq >= pp->seq) {
+            pp->pool = c->pool;
+            pp->where = c->where;
+            pp->seq = c->seq;
+         }
+      } else if (pp != NULL) {
+         pp->live -= (hi - lo < pp->live) ? hi - lo : pp->live;
+         if (pp->live == 0) VG_(free) (VG_(HT_remove) (ht_poolpages, pg));
+         else if (pp->seq == c->seq) pool_page_owner (pp);
+      }
+   }
+   if (add) {
+      c->pool->live += c->size;
+      if (c->pool->live > c->pool->peak_live) c->pool->peak_live = c->pool->live;
+   } else {
+      c->pool->live -= c->size < c->pool->live ? c->size : c->pool->live;
+   }
+}
+
+static
+void pool_chunk_free(Addr a)
+{
+   UWord k, v;
+   if (!VG_(delFromFM) (pool_chunks, &k, &v, a)) return;
+   PoolChunk *c = (PoolChunk *) v;
+   pool_account (c, False);
+   VG_(free) (c);
+}
+
+static
+void pool_chunk_alloc(ThreadId tid, struct map_pool *pool, Addr a, SizeT size)
+{
+   pool_chunk_free (a);
+   PoolChunk *c = VG_(malloc) (sizeof(*c));
+   c->start = a;
+   c->size = size;
+   c->pool = pool;
+   c->where = VG_(record_ExeContext) (tid, 0);
+   c->seq = ++pool_seq;
+   VG_(addToFM) (pool_chunks, a, (UWord) c);
+   pool_account (c, True);
+   pool->chunks++;
+}
+
+/**
+ * @brief like memcheck: free chunks of pool which are entirely outside [lo, hi),
+ * and trim those which are partially outside to the range
+ */
+static
+void pool_trim(const struct map_pool *pool, Addr lo, Addr hi)
+{
+   XArray *doomed = VG_(newXA) (VG_(malloc), "arr_pooldoomed", VG_(free), sizeof(Addr));
+   UWord k, v;
+   VG_(initIterFM) (pool_chunks);
+   while (VG_(nextIterFM) (pool_chunks, &k, &v)) {
+      const PoolChunk *c = (const PoolChunk *) v;
+      if (c->pool == pool && (c->start < lo || c->start + c->size > hi))
+         VG_(addToXA) (doomed, &c->start);
+   }
+   VG_(doneIterFM) (pool_chunks);
+   for (Word i = 0; i < VG_(sizeXA) (doomed); i++) {
+      const Addr a = *(Addr *) VG_(indexXA) (doomed, i);
+      VG_(lookupFM) (pool_chunks, &k, &v, a);
+      PoolChunk *c = (PoolChunk *) v;
+      const Addr start = c->start > lo ? c->start : lo;
+      const Addr end = c->start + c->size < hi ? c->start + c->size : hi;
+      if (end <= start) {
+         pool_chunk_free (a);
+         continue;
+      }
+      VG_(delFromFM) (pool_chunks, NULL, NULL, a);
+      pool_account (c, False);
+      c->start = start;
+      c->size = end - start;
+      VG_(addToFM) (pool_chunks, start, (UWord) c);
+      pool_account (c, True);
+   }
+   VG_(deleteXA) (doomed);
+}
+
+/**
+ * @brief memcheck's mempool client requests. Pools are identified by their
+ * anchor, chunks by their start address.
+ * @return True if handled
+ */
+static
+Bool pools_client_request(ThreadId tid, UWord *arg, UWord *ret)
+{
+   struct map_pool *pool;
+   switch (arg[0]) {
+   case VG_USERREQ__CREATE_MEMPOOL:
+      pool = VG_(HT_lookup) (ht_pools, arg[1]);
+      if (pool == NULL) {
+         pool = VG_(calloc) ("ws.pool", 1, sizeof(*pool));
+         pool->top.key = arg[1];
+         pool->id = pool_ids++;
+         VG_(HT_add_node) (ht_pools, (VgHashNode *) pool);
+      }
+      pool->where = VG_(record_ExeContext) (tid, 0);
+      pool->destroyed = False;
+      break;
+   case VG_USERREQ__DESTROY_MEMPOOL:
+      pool = VG_(HT_lookup) (ht_pools, arg[1]);
+      if (pool) {
+         pool_trim (pool, 0, 0);
+         pool->destroyed = True;
+      }
+      break;
+   case VG_USERREQ__MEMPOOL_ALLOC:
+      pool = VG_(HT_lookup) (ht_pools, arg[1]);
+      if (pool && arg[3] > 0) pool_chunk_alloc (tid, pool, (Addr) arg[2], (SizeT) arg[3]);
+      break;
+   case VG_USERREQ__MEMPOOL_FREE:
+      pool_chunk_free ((Addr) arg[2]);
+      break;
+   case VG_USERREQ__MEMPOOL_TRIM:
+      pool = VG_(HT_lookup) (ht_pools, arg[1]);
+      if (pool) pool_trim (pool, (Addr) arg[2], (Addr) arg[2] + (SizeT) arg[3]);
+      break;
+   case VG_USERREQ__MOVE_MEMPOOL:
+      pool = VG_(HT_remove) (ht_pools, arg[1]);
+      if (pool) {
+         pool->top.key = arg[2];
+         VG_(HT_add_node) (ht_pools, (VgHashNode *) pool);
+      }
+      break;
+   case VG_USERREQ__MEMPOOL_CHANGE: {
+      UWord k, v;
+      if (!VG_(lookupFM) (pool_chunks, &k, &v, arg[2])) break;
+      pool = ((PoolChunk *) v)->pool;
+      pool_chunk_free ((Addr) arg[2]);
+      if (arg[4] > 0) pool_chunk_alloc (tid, pool, (Addr) arg[3], (SizeT) arg[4]);
+      break;
+   }
+   case VG_USERREQ__MEMPOOL_EXISTS:
+      pool = VG_(HT_lookup) (ht_pools, arg[1]);
+      *ret = pool != NULL && !pool->destroyed;
+      return True;
+   default:
+      return False;
+   }
+   *ret = 0;
+   return True;
+}
+
+static
+void pools_sample(Time t, WorkingSet *ws, Bool *have_info)
+{
+   pagecount total = 0;
+   Time tmin = 0;
+   if (clo_tau < t) tmin = t - clo_tau;
+
+   VG_(HT_ResetIter) (ht_pools);
+   VgHashNode *nd;
+   while ((nd = VG_(HT_Next) (ht_pools))) ((struct map_pool *) nd)->ws_now = 0;
+
+   VG_(HT_ResetIter) (ht_poolpages);
+   while ((nd = VG_(HT_Next) (ht_poolpages))) {
+      const struct map_poolpage *pp = (const struct map_poolpage *) nd;
+      const struct map_pageaddr *page = VG_(HT_lookup) (ht_data, pp->top.key);
+      if (page == NULL || page->last_access <= tmin) continue;  // not in WS
+      total++;
+      pp->pool->ws_now++;
+      const UInt ecu = VG_(get_ECU_from_ExeContext) (pp->where);
+      struct map_poolsite *site = VG_(HT_lookup) (ht_poolsites, ecu);
+      if (site == NULL) {
+         site = VG_(calloc) ("ws.poolsite", 1, sizeof(*site));
+         site->top.key = ecu;
+         site->where = pp->where;
+         site->pool = pp->pool;
+         VG_(HT_add_node) (ht_poolsites, (VgHashNode *) site);
+      }
+      site->pages++;
+   }
+
+   VG_(HT_ResetIter) (ht_pools);
+   while ((nd = VG_(HT_Next) (ht_pools))) {
+      struct map_pool *pool = (struct map_pool *) nd;
+      pool->ws_sum += pool->ws_now;
+      if (pool->ws_now > pool->ws_max) pool->ws_max = pool->ws_now;
+   }
+   VG_(addToXA) (pool_samples, &total);
+}
+
+static
+void pools_header(VgFile *fp)
+{
+   VG_(fprintf) (fp, " %8s", "WSS_pool");
+}
+
+static
+void pools_row(VgFile *fp, UInt sample)
+{
+   VG_(fprintf) (fp, " %8u", *(const pagecount *) VG_(indexXA) (pool_samples, sample));
+}
+
+static
+Int map_pool_compare (const void *p1, const void *p2)
+{
+   const struct map_pool * const *a1 = (const struct map_pool * const *) p1;
+   const struct map_pool * const *a2 = (const struct map_pool * const *) p2;
+
+   if ((*a1)->ws_sum > (*a2)->ws_sum) return -1;
+   if ((*a1)->ws_sum < (*a2)->ws_sum) return 1;
+   return 0;
+}
+
+static
+Int map_poolsite_compare (const void *p1, const void *p2)
+{
+   const struct map_poolsite * const *a1 = (const struct map_poolsite * const *) p1;
+   const struct map_poolsite * const *a2 = (const struct map_poolsite * const *) p2;
+
+   if ((*a1)->pages > (*a2)->pages) return -1;
+   if ((*a1)->pages < (*a2)->pages) return 1;
+   return 0;
+}
+
+/**
+ * @brief data WS per pool and per allocation site of pool chunks
+ */
+static
+void print_pools(VgFile *fp)
+{
+   const ULong num_t = ws_at_time.num;
+   int nentry = VG_(HT_count_nodes) (ht_pools);
+   struct map_pool **pools = VG_(malloc) ((nentry + 1) * sizeof (*pools));
+   int npools = 0;
+   VG_(HT_ResetIter) (ht_pools);
+   VgHashNode *nd;
+   while ((nd = VG_(HT_Next) (ht_pools)))
+      pools[npools++] = (struct map_pool *) nd;
+   VG_(ssort) (pools, npools, sizeof (pools[0]), map_pool_compare);
+
+   VG_(fprintf) (fp, "%4s %18s %10s %10s %10s %10s %s", "pool", "anchor", "chunks", "peak_kB",
+                 "WSS_avg", "WSS_max", "created at");
+   for (int i = 0; i < npools; i++) {
+      const struct map_pool *p = pools[i];
+      HChar *where = get_callstack (p->where);
+      VG_(fprintf) (fp, "\n%4u %018p %10llu %10lu %10.1f %10u %s", p->id, (void*)p->top.key,
+                    p->chunks, (unsigned long) (p->peak_live / 1024),
+                    num_t ? (Float) p->ws_sum / num_t : 0.f, p->ws_max, where);
+      VG_(free) (where);
+   }
+   VG_(free) (pools);
+
+   nentry = VG_(HT_count_nodes) (ht_poolsites);
+   struct map_poolsite **sites = VG_(malloc) ((nentry + 1) * sizeof (*sites));
+   int nsites = 0;
+   VG_(HT_ResetIter) (ht_poolsites);
+   while ((nd = VG_(HT_Next) (ht_poolsites)))
+      sites[nsites++] = (struct map_poolsite *) nd;
+   VG_(ssort) (sites, nsites, sizeof (sites[0]), map_poolsite_compare);
+
+   VG_(fprintf) (fp, "\n\nAllocation sites:\n%12s %4s %s", "page-samples", "pool", "location");
+   for (int i = 0; i < nsites && i < HEAP_TOP_SITES; i++) {
+      HChar *where = get_callstack (sites[i]->where);
+      VG_(fprintf) (fp, "\n%12llu %4u %s", sites[i]->pages, sites[i]->pool->id, where);
+      VG_(free) (where);
+   }
+   if (nsites > HEAP_TOP_SITES) {
+      VG_(fprintf) (fp, "\n(%'d more sites)", nsites - HEAP_TOP_SITES);
+   }
+   VG_(free) (sites);
+}
+
+static
+void pool_free_chunk(UWord c)
+{
+   VG_(free) ((PoolChunk *) c);
+}
+
+static
+void pools_destroy(void)
+{
+   VG_(deleteFM) (pool_chunks, NULL, pool_free_chunk);
+   VG_(HT_destruct) (ht_poolpages, VG_(free));
+   VG_(HT_destruct) (ht_poolsites, VG_(free));
+   VG_(HT_destruct) (ht_pools, VG_(free));
+   VG_(deleteXA) (pool_samples);
+}
+
+/**
+ * @brief bulk access by a string function in vgpreload_ws. Every page of the
+ * range is accessed once per 8 bytes on it, at the time of the call. Access
+ * hooks see one access per line of HEAP_LINE_SIZE bytes.
+ */
+static
+void bulk_access(Addr a, SizeT len, Bool write)
+{
+   const Addr end = a + len;
+   if (len == 0 || end < a) return;
+   for (Addr pg = pageaddr(a); pg < end; pg += clo_pagesize) {
+      const Addr lo = pg > a ? pg : a;
+      const Addr hi = end - pg < clo_pagesize ? end : pg + clo_pagesize;
+      for (Addr l = lo; n_hook_access > 0 && l < hi; ) {
+         const Addr next = (l & ~(Addr) (HEAP_LINE_SIZE - 1)) + HEAP_LINE_SIZE;
+         const Addr lend = next < hi ? next : hi;
+         analyses_access (AccessData, l, lend - l);
+         l = lend;
+      }
+      if (pageaccess (pg, ht_data, &cache_data, &self_stats.data, (hi - lo + 7) / 8,
+                      write ? FT_WRITE_SIZE : 0))
+         analyses_page_entered (AccessData, lo);
+      if (pg + clo_pagesize < pg) break;  // top of address space
+   }
+   if (write) vol_written += len;
+   else vol_read += len;
+   vol_accesses += (len + 7) / 8;
+}
+
+/**
+ * @brief client requests, see ws.h
+ */
+static
+Bool ws_handle_client_request(ThreadId tid, UWord *arg, UWord *ret)
+{
+   if (clo_mempools && pools_client_request (tid, arg, ret)) return True;
+   if (!VG_IS_TOOL_USERREQ('W','S',arg[0])) return False;
+
+   switch (arg[0]) {
+   case VG_USERREQ__WS_HEAP_ALLOC:
+      if (clo_heap) heap_alloc (tid, (Addr) arg[1], (SizeT) arg[2]);
+      break;
+   case VG_USERREQ__WS_HEAP_FREE:
+      if (clo_heap) heap_free ((Addr) arg[1]);
+      break;
+   case VG_USERREQ__WS_RANGES:
+      if (clo_bulk && clo_track != TrackInsn && window_state == WindowOpen) {
+         bulk_access ((Addr) arg[3], (SizeT) arg[4], False);
+         bulk_access ((Addr) arg[1], (SizeT) arg[2], True);
+      }
+      break;
+   case VG_USERREQ__WS_BULK:
+      *ret = clo_bulk;
+      return True;
+   case VG_USERREQ__WS_HEAP:
+      *ret = clo_heap;
+      return True;
+   default:
+      VG_(umsg) ("Warning: unknown ws client request code %llx\n", (ULong) arg[0]);
+      return False;
+   }
+   *ret = 0;
+   return True;
+}
+
+static
+void madvise_init(void)
+{
+   ht_purged = VG_(HT_construct) ("ht_purged");
+   purged_per_sample = VG_(newXA) (VG_(malloc), "arr_purged", VG_(free), sizeof(UInt));
+}
+
+static
+void purge_page(struct map_pageaddr *page, Time now, Time tmin)
+{
+   if (page->last_access == 0) return;  // already purged, not touched since
+   purge_stats.pages++;
+   if (page->last_access > tmin) purge_stats.pages_in_ws++;
+   purged_since_sample++;
+   page->last_access = 0;
+
+   struct map_purged *pp = VG_(HT_lookup) (ht_purged, page->top.key);
+   if (pp == NULL) {
+      pp = VG_(malloc) (sizeof(*pp));
+      pp->top.key = page->top.key;
+      VG_(HT_add_node) (ht_purged, (VgHashNode *) pp);
+   }
+   pp->when = now;
+}
+
+/**
+ * @brief the contents of [a, a+len) are gone. Data pages which are completely
+ * inside leave the WS, the next access counts as a refault.
+ */
+static
+void purge_range(Addr a, SizeT len)
+{
+   const Time now = get_time();
+   Time tmin = 0;
+   if (clo_tau < now) tmin = now - clo_tau;
+   if (trace_fd >= 0) trace_record (now, a, len, TracePurge);
+
+   const Addr first = pageaddr(a + clo_pagesize - 1);
+   const Addr end = a + len;
+   if (len / clo_pagesize > VG_(HT_count_nodes) (ht_data)) {
+      // large reservations: visit known pages instead
+      VG_(HT_ResetIter) (ht_data);
+      VgHashNode *nd;
+      while ((nd = VG_(HT_Next) (ht_data))) {
+         if (nd->key >= first && nd->key + clo_pagesize <= end)
+            purge_page ((struct map_pageaddr *) nd, now, tmin);
+      }
+   } else {
+      for (Addr pg = first; pg + clo_pagesize <= end; pg += clo_pagesize) {
+         struct map_pageaddr *page = VG_(HT_lookup) (ht_data, pg);
+         if (page) purge_page (page, now, tmin);
+      }
+   }
+}
+
+static
+void madvise_page_entered(AccessKind kind, Addr addr)
+{
+   if (kind != AccessData) return;
+   struct map_purged *pp = VG_(HT_remove) (ht_purged, pageaddr(addr));
+   if (pp == NULL) return;
+
+   const ULong dist = get_time() - pp->when;
+   UInt bin = 0;
+   for (ULong d = dist / 1000; d > 0 && bin < MADV_BINS - 1; d /= 10) bin++;
+   purge_stats.refaults++;
+   purge_stats.dist[bin]++;
+   if (dist < clo_tau) purge_stats.refaults_tau++;
+   VG_(free) (pp);
+}
+
+static
+void madvise_sample(Time t, WorkingSet *ws, Bool *have_info)
+{
+   VG_(addToXA) (purged_per_sample, &purged_since_sample);
+   purged_since_sample = 0;
+}
+
+static
+void madvise_header(VgFile *fp)
+{
+   VG_(fprintf) (fp, " %8s", "purged");
+}
+
+static
+void madvise_row(VgFile *fp, UInt sample)
+{
+   VG_(fprintf) (fp, " %8u", *(UInt *) VG_(indexXA) (purged_per_sample, sample));
+}
+
+static
+void print_purge_stats(VgFile *fp)
+{
+   const PurgeStats *ps = &purge_stats;
+   VG_(fprintf) (fp, "madvise calls:     %'llu (DONTNEED %'llu, FREE %'llu)\n",
+                 ps->calls_dontneed + ps->calls_free, ps->calls_dontneed, ps->calls_free);
+   VG_(fprintf) (fp, "Pages purged:      %'llu, in WS %'llu\n", ps->pages, ps->pages_in_ws);
+   VG_(fprintf) (fp, "Pages refaulted:   %'llu (%u%%), within tau %'llu\n",
+                 ps->refaults, percent(ps->refaults, ps->pages), ps->refaults_tau);
+   VG_(fprintf) (fp, "Refault distance [%s]:", TimeUnit_to_string(clo_time_unit));
+   for (Int b = 0; b < MADV_BINS; b++) {
+      VG_(fprintf) (fp, "\n%7s%d %12llu", b + 1 < MADV_BINS ? "<1e" : ">=1e",
+                    b + 1 < MADV_BINS ? b + 3 : b + 2, ps->dist[b]);
+   }
+   VG_(fprintf) (fp, "\n%8s %12u", "never", VG_(HT_count_nodes) (ht_purged));
+}
+
+static
+void madvise_destroy(void)
+{
+   VG_(HT_destruct) (ht_purged, VG_(free));
+   VG_(deleteXA) (purged_per_sample);
+}
+
+static
+void ws_pre_syscall(ThreadId tid, UInt syscallno, UWord *args, UInt nArgs)
+{
+}
+
+/**
+ * @brief see --ws-madvise, and the heap of --ws-list-pages
+ */
+static
+void ws_post_syscall(ThreadId tid, UInt syscallno, UWord *args, UInt nArgs, SysRes res)
+{
+   if (syscallno == __NR_brk && brk_base == 0 && !sr_isError(res)) {
+      brk_base = sr_Res(res);  // the first brk() queries the initial break
+      return;
+   }
+   if (!clo_madvise || syscallno != __NR_madvise || sr_isError(res)) return;
+   switch (args[2]) {
+   case VKI_MADV_DONTNEED:
+      purge_stats.calls_dontneed++;
+      break;
+   case VKI_MADV_FREE:
+      purge_stats.calls_free++;
+      break;
+   default:
+      return;
+   }
+   purge_range ((Addr) args[0], (SizeT) args[1]);
+}
+
+static
+void stacks_init(void)
+{
+   thread_stacks = VG_(calloc) ("ws.thread_stacks", VG_N_THREADS, sizeof(thread_stacks[0]));
+   stacks_done = VG_(newXA) (VG_(malloc), "arr_stacks", VG_(free), sizeof(ThreadStack));
+   stack_roles = VG_(newXA) (VG_(malloc), "arr_roles", VG_(free), sizeof(HChar*));
+   stack_wss   = VG_(newXA) (VG_(malloc), "arr_stackwss", VG_(free), sizeof(UInt));
+   VG_(track_pre_thread_ll_exit) (stacks_thread_exit);
+}
+
+static
+Bool stack_is_startup(const HChar *fn)
+{
+   static const HChar *startup[] = {
+      "(below main)", "_start", "__libc_start_main", "__libc_start_call_main",
+      "start_thread", "clone", "__clone", "clone3", "__clone3",
+      "thread_start", "_pthread_start", NULL
+   };
+   for (Int i = 0; startup[i]; i++) {
+      if (VG_(strcmp) (fn, startup[i]) == 0) return True;
+   }
+   return False;
+}
+
+/**
+ * @brief outermost function of the thread which is not startup code, i.e.,
+ * main or the thread's entry function. NULL if the stack is not deep enough yet.
+ */
+static
+const HChar* stack_role(ThreadId tid)
+{
+   Addr ips[STACK_ROLE_DEPTH];
+   const UInt n = VG_(get_StackTrace) (tid, ips, STACK_ROLE_DEPTH, NULL, NULL, 0);
+   if (n == 0 || n == STACK_ROLE_DEPTH) return NULL;  // outermost frame not seen
+
+   const DiEpoch ep = VG_(current_DiEpoch)();
+   for (Int i = n - 1; i >= 0; i--) {
+      const HChar *fn;
+      if (!VG_(get_fnname) (ep, ips[i], &fn)) return NULL;
+      if (stack_is_startup (fn)) continue;
+
+      // intern, there are only few roles
+      for (Int r = 0; r < VG_(sizeXA) (stack_roles); r++) {
+         const HChar *role = *(HChar **) VG_(indexXA) (stack_roles, r);
+         if (VG_(strcmp) (role, fn) == 0) return role;
+      }
+      HChar *role = VG_(strdup) ("ws.stack_role", fn);
+      VG_(addToXA) (stack_roles, &role);
+      return role;
+   }
+   return NULL;
+}
+
+static
+void stacks_thread_exit(ThreadId tid)
+{
+   ThreadStack *ts = &thread_stacks[tid];
+   if (ts->stack_max != 0) VG_(addToXA) (stacks_done, ts);
+   VG_(memset) (ts, 0, sizeof(*ts));
+}
+
+static
+void stacks_access(AccessKind kind, Addr addr, SizeT size)
+{
+   if (kind != AccessData) return;
+   const ThreadId tid = VG_(get_running_tid)();
+   if (tid >= VG_N_THREADS) return;
+   ThreadStack *ts = &thread_stacks[tid];
+   if (UNLIKELY(ts->stack_max == 0)) {
+      ts->tid = tid;
+      ts->stack_max = VG_(thread_get_stack_max) (tid);
+      ts->stack_min = ts->stack_max - VG_(thread_get_stack_size) (tid);
+      ts->lowest = ts->stack_max;
+   }
+   if (addr >= ts->lowest || addr < ts->stack_min) return;  // no new low, or not on the stack
+
+   // the thread's entry function shows once the stack grows
+   const Bool new_page = pageaddr(addr) < pageaddr(ts->lowest);
+   ts->lowest = addr;
+   if (new_page && ts->role == NULL) ts->role = stack_role (tid);
+}
+
+static
+void stacks_sample(Time t, WorkingSet *ws, Bool *have_info)
+{
+   Time tmin = 0;
+   if (clo_tau < t) tmin = t - clo_tau;
+
+   UInt total = 0;
+   for (ThreadId tid = 1; tid < VG_N_THREADS; tid++) {
+      ThreadStack *ts = &thread_stacks[tid];
+      if (ts->lowest == ts->stack_max) continue;  // not started, or no stack access yet
+      UInt n = 0;
+      for (Addr pg = pageaddr(ts->lowest); pg < ts->stack_max; pg += clo_pagesize) {
+         const struct map_pageaddr *page = VG_(HT_lookup) (ht_data, pg);
+         if (page && page->last_access > tmin) n++;
+      }
+      ts->wss_sum += n;
+      ts->samples++;
+      if (n > ts->wss_max) ts->wss_max = n;
+      total += n;
+      if (ts->role == NULL && !postmortem) ts->role = stack_role (tid);
+   }
+   VG_(addToXA) (stack_wss, &total);
+}
+
+static
+void stacks_fini(void)
+{
+   for (ThreadId tid = 1; tid < VG_N_THREADS; tid++) stacks_thread_exit (tid);
+}
+
+static
+void stacks_header(VgFile *fp)
+{
+   VG_(fprintf) (fp, " %9s", "WSS_stack");
+}
+
+static
+void stacks_row(VgFile *fp, UInt sample)
+{
+   VG_(fprintf) (fp, " %9u", *(UInt *) VG_(indexXA) (stack_wss, sample));
+}
+
+/**
+ * @brief per thread and per role: high-water mark and stack WSS. The recommended
+ * stack size is the largest high-water mark of the role plus 50%, in 16 kB steps.
+ */
+static
+void print_stack_usage(VgFile *fp)
+{
+   const Int nthreads = VG_(sizeXA) (stacks_done);
+   const Int nroles = VG_(sizeXA) (stack_roles);
+   Addr  *role_hw = VG_(calloc) ("ws.role_hw", nroles + 1, sizeof(Addr));
+   ULong *role_wss = VG_(calloc) ("ws.role_wss", nroles + 1, sizeof(ULong));
+   ULong *role_samples = VG_(calloc) ("ws.role_samples", nroles + 1, sizeof(ULong));
+   UInt  *role_threads = VG_(calloc) ("ws.role_threads", nroles + 1, sizeof(UInt));
+
+   VG_(fprintf) (fp, "%4s %14s %8s %8s %s", "tid", "high-water_kB", "WSS_avg", "WSS_max", "role");
+   for (Int i = 0; i < nthreads; i++) {
+      const ThreadStack *ts = VG_(indexXA) (stacks_done, i);
+      const Addr hw = ts->stack_max - ts->lowest;
+      VG_(fprintf) (fp, "\n%4u %14.1f %8.1f %8u %s", ts->tid, hw / 1024.f,
+                    ts->samples ? (Float) ts->wss_sum / ts->samples : 0.f, ts->wss_max,
+                    ts->role ? ts->role : "???");
+
+      // group, roles are interned; unknown is the last
+      Int r = nroles;
+      for (Int k = 0; k < nroles; k++) {
+         if (*(HChar **) VG_(indexXA) (stack_roles, k) == ts->role) r = k;
+      }
+      if (hw > role_hw[r]) role_hw[r] = hw;
+      role_wss[r] += ts->wss_sum;
+      role_samples[r] += ts->samples;
+      role_threads[r]++;
+   }
+
+   VG_(fprintf) (fp, "\n\n%7s %14s %8s %14s %s", "threads", "high-water_kB", "WSS_avg",
+                 "recommend_kB", "role");
+   for (Int r = 0; r <= nroles; r++) {
+      if (role_threads[r] == 0) continue;
+      const ULong rec = ((role_hw[r] * 3 / 2 + STACK_REC_STEP - 1) / STACK_REC_STEP) * STACK_REC_STEP;
+      VG_(fprintf) (fp, "\n%7u %14.1f %8.1f %14llu %s", role_threads[r], role_hw[r] / 1024.f,
+                    role_samples[r] ? (Float) role_wss[r] / role_samples[r] : 0.f,
+                    (rec > STACK_REC_STEP ? rec : STACK_REC_STEP) / 1024,
+                    r < nroles ? *(HChar **) VG_(indexXA) (stack_roles, r) : "???");
+   }
+   VG_(free) (role_hw);
+   VG_(free) (role_wss);
+   VG_(free) (role_samples);
+   VG_(free) (role_threads);
+}
+
+static
+void stacks_destroy(void)
+{
+   for (Int r = 0; r < VG_(sizeXA) (stack_roles); r++) {
+      VG_(free) (*(HChar **) VG_(indexXA) (stack_roles, r));
+   }
+   VG_(deleteXA) (stack_roles);
+   VG_(deleteXA) (stacks_done);
+   VG_(deleteXA) (stack_wss);
+   VG_(free) (thread_stacks);
+}
+
+static
+void jit_init(void)
+{
+   ht_discarded = VG_(HT_construct) ("ht_discarded");
+   jit_samples = VG_(newXA) (VG_(malloc), "arr_jit", VG_(free), sizeof(JitSample));
+}
+
+static
+void jit_retouched(const struct map_discarded *dp, const struct map_pageaddr *page)
+{
+   jit_stats.retouched++;
+   if (page->last_access - dp->when < clo_tau) jit_stats.retouched_tau++;
+}
+
+/**
+ * @brief translations of code in vge were thrown away: self-modifying code,
+ * VALGRIND_DISCARD_TRANSLATIONS of a JIT, or unmapping. Valgrind also discards
+ * when a new translation recycles a full sector of its code cache; the code did
+ * not change then, so these evictions are only counted.
+ */
+static
+void ws_discard_superblock_info(Addr orig_addr, VexGuestExtents vge)
+{
+   if (!clo_jit || discarding_own) return;  // not the client's doing
+   jit_stats.discards++;
+   if (jit_translating) {
+      jit_stats.evictions++;
+      return;
+   }
+   const Time now = get_time();
+   for (UInt e = 0; e < vge.n_used; e++) {
+      const Addr end = vge.base[e] + vge.len[e];
+      for (Addr pg = pageaddr(vge.base[e]); pg < end; pg += clo_pagesize) {
+         struct map_pageaddr *page = VG_(HT_lookup) (ht_insn, pg);
+         if (page == NULL) continue;
+         // one discard per generation, although every superblock on the page is discarded
+         struct map_discarded *dp = VG_(HT_lookup) (ht_discarded, pg);
+         if (dp && dp->count == page->count) continue;  // not executed since
+         if (dp) {
+            jit_retouched (dp, page);
+         } else {
+            dp = VG_(malloc) (sizeof(*dp));
+            dp->top.key = pg;
+            VG_(HT_add_node) (ht_discarded, (VgHashNode *) dp);
+         }
+         dp->when = now;
+         dp->count = page->count;
+         if (page->gen < 0xffff) page->gen++;
+         page->kind = CodeJit;
+         jit_stats.pages++;
+         jit_churn++;
+      }
+   }
+}
+
+/**
+ * @brief JIT code lives in anonymous mappings, or was discarded at least once
+ */
+static
+Bool jit_is_jit(struct map_pageaddr *page)
+{
+   if (page->kind == CodeUnknown) {
+      const NSegment *seg = VG_(am_find_nsegment) (page->top.key);
+      page->kind = (seg == NULL || seg->kind == SkFileC) ? CodeStatic : CodeJit;
+   }
+   return page->kind == CodeJit;
+}
+
+static
+void jit_sample(Time t, WorkingSet *ws, Bool *have_info)
+{
+   Time tmin = 0;
+   if (clo_tau < t) tmin = t - clo_tau;
+
+   // discarded pages which were executed again
+   UInt n = 0;
+   VgHashNode **disc = VG_(HT_to_array) (ht_discarded, &n);
+   for (UInt i = 0; i < n; i++) {
+      const struct map_discarded *dp = (const struct map_discarded *) disc[i];
+      const struct map_pageaddr *page = VG_(HT_lookup) (ht_insn, dp->top.key);
+      if (page->count == dp->count) continue;
+      jit_retouched (dp, page);
+      VG_(free) (VG_(HT_remove) (ht_discarded, dp->top.key));
+   }
+   VG_(free) (disc);
+
+   JitSample js = { 0, jit_churn };
+   VG_(HT_ResetIter) (ht_insn);
+   VgHashNode *nd;
+   while ((nd = VG_(HT_Next) (ht_insn))) {
+      struct map_pageaddr *page = (struct map_pageaddr *) nd;
+      if (page->last_access > tmin && jit_is_jit (page)) js.wss_jit++;
+   }
+   VG_(addToXA) (jit_samples, &js);
+   jit_churn = 0;
+
+   const pagecount wss_static = ws->pages_insn - js.wss_jit;
+   jit_stats.jit_sum += js.wss_jit;
+   jit_stats.static_sum += wss_static;
+   if (js.wss_jit > jit_stats.jit_peak) jit_stats.jit_peak = js.wss_jit;
+   if (wss_static > jit_stats.static_peak) jit_stats.static_peak = wss_static;
+}
+
+static
+void jit_header(VgFile *fp)
+{
+   VG_(fprintf) (fp, " %8s %8s", "WSS_jit", "churn");
+}
+
+static
+void jit_row(VgFile *fp, UInt sample)
+{
+   const JitSample *js = VG_(indexXA) (jit_samples, sample);
+   VG_(fprintf) (fp, " %8u %8u", js->wss_jit, js->churn);
+}
+
+static
+void print_jit_stats(VgFile *fp)
+{
+   const JitStats *js = &jit_stats;
+   const Word n = VG_(sizeXA) (jit_samples);
+   VG_(fprintf) (fp, "Discard events:      %'llu, code cache evictions %'llu (not counted)\n",
+                 js->discards, js->evictions);
+   VG_(fprintf) (fp, "Pages discarded:     %'llu, executed again %'llu (%u%%), within tau %'llu\n",
+                 js->pages, js->retouched, percent(js->retouched, js->pages), js->retouched_tau);
+   VG_(fprintf) (fp, "JIT WSS avg/peak:    %'.1f/%'u pages\n",
+                 n > 0 ? (Float) js->jit_sum / n : 0.f, js->jit_peak);
+   VG_(fprintf) (fp, "Static WSS avg/peak: %'.1f/%'u pages",
+                 n > 0 ? (Float) js->static_sum / n : 0.f, js->static_peak);
+}
+
+static
+void jit_destroy(void)
+{
+   VG_(HT_destruct) (ht_discarded, VG_(free));
+   VG_(deleteXA) (jit_samples);
+}
+
+static
+void volume_init(void)
+{
+   volume_samples = VG_(newXA) (VG_(malloc), "arr_volume", VG_(free), sizeof(VolumeSample));
+}
+
+static
+void volume_sample(Time t, WorkingSet *ws, Bool *have_info)
+{
+   static ULong pre_read = 0, pre_written = 0, pre_accesses = 0;
+   VolumeSample vs;
+   vs.read = vol_read - pre_read;
+   vs.written = vol_written - pre_written;
+   vs.accesses = vol_accesses - pre_accesses;
+   vs.pages_data = ws->pages_data;
+   VG_(addToXA) (volume_samples, &vs);
+   pre_read = vol_read;
+   pre_written = vol_written;
+   pre_accesses = vol_accesses;
+}
+
+static
+void volume_header(VgFile *fp)
+{
+   VG_(fprintf) (fp, " %10s %10s %8s %8s", "read_kB", "write_kB", "acc/page", "B/fp");
+}
+
+/**
+ * @brief bytes and accesses of the sample interval; acc/page per WS data page,
+ * B/fp is bytes per byte of data WS (footprint)
+ */
+static
+void volume_row(VgFile *fp, UInt sample)
+{
+   const VolumeSample *vs = VG_(indexXA) (volume_samples, sample);
+   const Float fp_pages = vs->pages_data > 0 ? (Float) vs->pages_data : 1.f;
+   VG_(fprintf) (fp, " %10llu %10llu %8.1f %8.2f", vs->read / 1024, vs->written / 1024,
+                 vs->accesses / fp_pages, (vs->read + vs->written) / (fp_pages * clo_pagesize));
+}
+
+static
+void forecast_init(void)
+{
+   forecast_samples = VG_(newXA) (VG_(malloc), "arr_forecast", VG_(free), sizeof(ForecastSample));
+   forecast_ring = VG_(calloc) ("ws.forecast_ring", clo_forecast, sizeof(forecast_ring[0]));
+}
+
+/**
+ * @brief Holt's linear exponential smoothing of the total WSS. Each sample is
+ * compared with the forecast made --ws-forecast samples earlier, and with the
+ * limit a policy would have set from it.
+ */
+static
+void forecast_sample(Time t, WorkingSet *ws, Bool *have_info)
+{
+   ForecastState *fs = &forecast_state;
+   const Double y = ws->pages_insn + ws->pages_data;
+   const UInt slot = fs->n % clo_forecast;
+   ForecastSample out = { -1, 0 };
+
+   // evaluate forecast made k samples ago
+   if (fs->n >= clo_forecast) {
+      const Double pred = forecast_ring[slot];
+      const Double limit = pred * (1. + clo_forecast_headroom);
+      out.fcast = (Int) (pred + .5);
+      out.err = (Int) (y - out.fcast);
+      fs->evaluated++;
+      fs->abs_err += out.err < 0 ? -out.err : out.err;
+      fs->bias += out.err;
+      if (y > limit) {
+         const Double excess = y - limit;
+         fs->exceeded++;
+         fs->excess_sum += excess;
+         if (excess > fs->excess_max) fs->excess_max = excess;
+      } else {
+         fs->slack_sum += limit - y;
+      }
+   }
+   VG_(addToXA) (forecast_samples, &out);
+
+   // update level and trend
+   if (fs->n == 0) {
+      fs->level = y;
+      fs->trend = 0.;
+   } else {
+      const Double level_pre = fs->level;
+      fs->level = clo_forecast_alpha * y + (1. - clo_forecast_alpha) * (fs->level + fs->trend);
+      fs->trend = clo_forecast_beta * (fs->level - level_pre) + (1. - clo_forecast_beta) * fs->trend;
+   }
+   const Double pred = fs->level + clo_forecast * fs->trend;
+   forecast_ring[slot] = pred > 0. ? pred : 0.;
+   fs->n++;
+}
+
+static
+void forecast_header(VgFile *fp)
+{
+   VG_(fprintf) (fp, " %8s %8s", "fcast", "err");
+}
+
+static
+void forecast_row(VgFile *fp, UInt sample)
+{
+   const ForecastSample *fs = VG_(indexXA) (forecast_samples, sample);
+   if (fs->fcast < 0) {
+      VG_(fprintf) (fp, " %8s %8s", "-", "-");
+   } else {
+      VG_(fprintf) (fp, " %8d %8d", fs->fcast, fs->err);
+   }
+}
+
+static
+void print_forecast(VgFile *fp)
+{
+   const ForecastState *fs = &forecast_state;
+   const ULong n = fs->evaluated;
+   const ULong ok = n - fs->exceeded;
+   VG_(fprintf) (fp, "Horizon:           %d samples\n", clo_forecast);
+   VG_(fprintf) (fp, "Smoothing:         alpha %.2f, beta %.2f\n",
+                 clo_forecast_alpha, clo_forecast_beta);
+   VG_(fprintf) (fp, "Forecasts:         %'llu, mean abs. error %.1f pages, bias %.1f pages\n",
+                 n, n ? fs->abs_err / n : 0., n ? fs->bias / n : 0.);
+   VG_(fprintf) (fp, "Limit policy:      forecast + %.0f%%\n", 100. * clo_forecast_headroom);
+   VG_(fprintf) (fp, "Limit exceeded:    %'llu times (%u%%), by %.1f pages avg, %.0f max\n",
+                 fs->exceeded, percent(fs->exceeded, n),
+                 fs->exceeded ? fs->excess_sum / fs->exceeded : 0., fs->excess_max);
+   VG_(fprintf) (fp, "Unused limit:      %.1f pages avg, when not exceeded",
+                 ok ? fs->slack_sum / ok : 0.);
+}
+
+static
+void prefetch_init(void)
+{
+   ht_resident = VG_(HT_construct) ("ht_resident");
+   ht_pfsites  = VG_(HT_construct) ("ht_pfsites");
+   pf_markov   = VG_(calloc) ("ws.pf_markov", clo_prefetch_table, sizeof(pf_markov[0]));
+   pf_windows  = VG_(newXA) (VG_(malloc), "arr_pfwindows", VG_(free), sizeof(PfWindow));
+}
+
+static
+void resident_unlink(struct map_resident *r)
+{
+   if (r->newer) r->newer->older = r->older; else resident_mru = r->older;
+   if (r->older) r->older->newer = r->newer; else resident_lru = r->newer;
+}
+
+static
+void resident_push(struct map_resident *r)
+{
+   r->newer = NULL;
+   r->older = resident_mru;
+   if (resident_mru) resident_mru->newer = r; else resident_lru = r;
+   resident_mru = r;
+}
+
+/**
+ * @brief access to a page of the simulated resident set. A miss loads the
+ * page, and evicts the least recently used one if the set is full.
+ * @return True if the page was resident
+ */
+static
+Bool resident_touch(Addr pg)
+{
+   struct map_resident *r = VG_(HT_lookup) (ht_resident, pg);
+   if (r) {
+      if (r != resident_mru) {
+         resident_unlink (r);
+         resident_push (r);
+      }
+      return True;
+   }
+   if (resident_n == clo_prefetch) {
+      r = resident_lru;  // node is reused for the new page
+      resident_unlink (r);
+      VG_(HT_remove) (ht_resident, r->top.key);
+   } else {
+      r = VG_(malloc) (sizeof(*r));
+      resident_n++;
+   }
+   r->top.key = pg;
+   VG_(HT_add_node) (ht_resident, (VgHashNode *) r);
+   resident_push (r);
+   return False;
+}
+
+/**
+ * @brief a prefetcher predicts page pg. Resident pages and pages already in its
+ * buffer are not fetched again.
+ */
+static
+void prefetch_issue(Prefetcher *p, Addr pg, Time now)
+{
+   if (pg == 0 || VG_(HT_lookup) (ht_resident, pg)) return;
+   for (UInt i = 0; i < PF_BUFFER; i++) {
+      if (p->buf[i].page == pg) return;
+   }
+   p->buf[p->next].page = pg;
+   p->buf[p->next].issued = now;
+   p->next = (p->next + 1) % PF_BUFFER;
+   p->total.issued++;
+   p->win.issued++;
+}
+
+static
+void prefetch_count_useful(PfCounters *c, Time lead)
+{
+   c->useful++;
+   c->lead_sum += lead;
+   if (lead >= clo_prefetch_latency) c->timely++;
+}
+
+/**
+ * @brief miss on page pg; if the prefetcher has it, the prefetch was useful
+ * @return True if the miss was covered
+ */
+static
+Bool prefetch_use(Prefetcher *p, Addr pg, Time now)
+{
+   for (UInt i = 0; i < PF_BUFFER; i++) {
+      if (p->buf[i].page != pg) continue;
+      const Time lead = now - p->buf[i].issued;
+      p->buf[i].page = 0;
+      prefetch_count_useful (&p->total, lead);
+      prefetch_count_useful (&p->win, lead);
+      return True;
+   }
+   return False;
+}
+
+static
+PfMarkovEntry* prefetch_markov_entry(Addr pg)
+{
+   return &pf_markov[(pg / clo_pagesize) % clo_prefetch_table];
+}
+
+/**
+ * @brief a miss out of the resident set. Each prefetcher is scored on it, then
+ * trained and asked for its prediction. The prefetchers are independent of each
+ * other, and prefetched pages do not enter the resident set, so the miss stream
+ * is the same for all of them.
+ */
+static
+void prefetch_miss(Addr pg, Time now)
+{
+   pf_misses++;
+   pf_win_misses++;
+
+   Bool covered = False;
+   for (Int k = 0; k < PF_N; k++) {
+      if (prefetch_use (&prefetchers[k], pg, now)) covered = True;
+   }
+
+   if (clo_track == TrackData) pf_ip = VG_(get_IP) (VG_(get_running_tid) ());
+   struct map_pfsite *site = VG_(HT_lookup) (ht_pfsites, pf_ip);
+   if (site == NULL) {
+      site = VG_(malloc) (sizeof(*site));
+      site->top.key = pf_ip;
+      site->ep = VG_(current_DiEpoch)();
+      site->misses = 0;
+      site->unpredicted = 0;
+      VG_(HT_add_node) (ht_pfsites, (VgHashNode *) site);
+   }
+   site->misses++;
+   if (!covered) site->unpredicted++;
+
+   // sequential: the next pages
+   for (Int d = 1; d <= PF_DEGREE; d++)
+      prefetch_issue (&prefetchers[PfSequential], pg + d * clo_pagesize, now);
+
+   // stride: per code site, once the same stride was seen twice
+   PfStrideEntry *se = &pf_strides[(pf_ip >> 2) % PF_STRIDES];
+   if (se->ip == pf_ip) {
+      const Long stride = (Long) pg - (Long) se->last;
+      se->steady = stride != 0 && stride == se->stride;
+      se->stride = stride;
+   } else {
+      se->ip = pf_ip;
+      se->stride = 0;
+      se->steady = False;
+   }
+   se->last = pg;
+   if (se->steady) {
+      for (Int d = 1; d <= PF_DEGREE; d++)
+         prefetch_issue (&prefetchers[PfStride], pg + d * se->stride, now);
+   }
+
+   // Markov: learn the transition from the previous miss, predict the successors of this one
+   if (pf_last_miss != 0) {
+      PfMarkovEntry *me = prefetch_markov_entry (pf_last_miss);
+      if (me->page != pf_last_miss) {
+         me->page = pf_last_miss;
+         me->succ[0] = pg;
+         me->succ[1] = 0;
+      } else if (me->succ[0] != pg) {
+         me->succ[1] = me->succ[0];
+         me->succ[0] = pg;
+      }
+   }
+   const PfMarkovEntry *me = prefetch_markov_entry (pg);
+   if (me->page == pg) {
+      for (Int i = 0; i < 2; i++) prefetch_issue (&prefetchers[PfMarkov], me->succ[i], now);
+   }
+   pf_last_miss = pg;
+}
+
+static
+void prefetch_access(AccessKind kind, Addr addr, SizeT size)
+{
+   if (kind == AccessInsn) pf_ip = addr;
+   pf_accesses++;
+   const Addr pg = pageaddr(addr);
+   if (pg == resident_last) return;  // still MRU
+   resident_last = pg;
+   if (!resident_touch (pg)) prefetch_miss (pg, get_time());
+}
+
+static
+void prefetch_window_close(Time t)
+{
+   PfWindow w;
+   w.t = t;
+   w.misses = pf_win_misses;
+   for (Int k = 0; k < PF_N; k++) {
+      w.pf[k] = prefetchers[k].win;
+      VG_(memset) (&prefetchers[k].win, 0, sizeof(PfCounters));
+   }
+   VG_(addToXA) (pf_windows, &w);
+   pf_win_misses = 0;
+   pf_win_samples = 0;
+}
+
+static
+void prefetch_sample(Time t, WorkingSet *ws, Bool *have_info)
+{
+   if (++pf_win_samples == PF_WINDOW) prefetch_window_close (t);
+}
+
+static
+void prefetch_fini(void)
+{
+   if (pf_win_samples > 0 || pf_win_misses > 0) prefetch_window_close (get_time());
+}
+
+static
+void print_percent_or_none(VgFile *fp, ULong part, ULong whole)
+{
+   if (whole > 0) {
+      VG_(fprintf) (fp, " %7u", percent(part, whole));
+   } else {
+      VG_(fprintf) (fp, " %7s", "-");
+   }
+}
+
+static
+Int map_pfsite_compare (const void *p1, const void *p2)
+{
+   const struct map_pfsite * const *a1 = (const struct map_pfsite * const *) p1;
+   const struct map_pfsite * const *a2 = (const struct map_pfsite * const *) p2;
+
+   if ((*a1)->unpredicted > (*a2)->unpredicted) return -1;
+   if ((*a1)->unpredicted < (*a2)->unpredicted) return 1;
+   return 0;
+}
+
+/**
+ * @brief accuracy is useful/issued prefetches, coverage is covered/all misses,
+ * timely are useful prefetches issued at least --ws-prefetch-latency before use
+ */
+static
+void print_prefetch(VgFile *fp)
+{
+   static const HChar *names[PF_N] = { "sequential", "stride", "markov" };
+   static const HChar *abbrev[PF_N] = { "seq", "str", "mkv" };
+
+   VG_(fprintf) (fp, "Resident set:      %d pages, LRU\n", clo_prefetch);
+   VG_(fprintf) (fp, "Accesses/misses:   %'llu/%'llu\n", pf_accesses, pf_misses);
+   VG_(fprintf) (fp, "Markov table:      %d entries\n", clo_prefetch_table);
+   VG_(fprintf) (fp, "Latency:           %d %s\n", clo_prefetch_latency,
+                 TimeUnit_to_string(clo_time_unit));
+   VG_(fprintf) (fp, "%-10s %12s %12s %8s %8s %8s %12s", "prefetcher", "issued", "useful",
+                 "accuracy", "coverage", "timely", "lead_avg");
+   for (Int k = 0; k < PF_N; k++) {
+      const PfCounters *c = &prefetchers[k].total;
+      VG_(fprintf) (fp, "\n%-10s %12llu %12llu %7u%% %7u%% %7u%% %12llu", names[k],
+                    c->issued, c->useful, percent(c->useful, c->issued),
+                    percent(c->useful, pf_misses), percent(c->timely, c->useful),
+                    c->useful ? c->lead_sum / c->useful : 0);
+   }
+
+   // accuracy, coverage and timeliness per window
+   VG_(fprintf) (fp, "\n\nWindows of %d samples, in %%:\n%14s %10s", PF_WINDOW, "t", "misses");
+   for (Int k = 0; k < PF_N; k++) {
+      VG_(fprintf) (fp, "  acc_%s  cov_%s  tml_%s", abbrev[k], abbrev[k], abbrev[k]);
+   }
+   for (Int i = 0; i < VG_(sizeXA) (pf_windows); i++) {
+      const PfWindow *w = VG_(indexXA) (pf_windows, i);
+      VG_(fprintf) (fp, "\n%14llu %10llu", w->t, w->misses);
+      for (Int k = 0; k < PF_N; k++) {
+         print_percent_or_none (fp, w->pf[k].useful, w->pf[k].issued);
+         print_percent_or_none (fp, w->pf[k].useful, w->misses);
+         print_percent_or_none (fp, w->pf[k].timely, w->pf[k].useful);
+      }
+   }
+
+   // code sites whose misses no prefetcher saw coming
+   int nsites = 0;
+   const int nentry = VG_(HT_count_nodes) (ht_pfsites);
+   struct map_pfsite **sites = VG_(malloc) ((nentry + 1) * sizeof (*sites));
+   VG_(HT_ResetIter) (ht_pfsites);
+   VgHashNode *nd;
+   while ((nd = VG_(HT_Next) (ht_pfsites))) {
+      if (((struct map_pfsite *) nd)->unpredicted > 0) sites[nsites++] = (struct map_pfsite *) nd;
+   }
+   VG_(ssort) (sites, nsites, sizeof (sites[0]), map_pfsite_compare);
+
+   VG_(fprintf) (fp, "\n\nUnpredictable misses by code site:\n%10s %12s %s", "misses",
+                 "unpredicted", "location");
+   for (int i = 0; i < nsites && i < PF_TOP_SITES; i++) {
+      const HChar *where = VG_(describe_IP) (sites[i]->ep, sites[i]->top.key, NULL);
+      VG_(fprintf) (fp, "\n%10llu %12llu %s", sites[i]->misses, sites[i]->unpredicted, where);
+   }
+   if (nsites > PF_TOP_SITES) {
+      VG_(fprintf) (fp, "\n(%'d more sites)", nsites - PF_TOP_SITES);
+   }
+   VG_(free) (sites);
+}
+
+static
+void prefetch_destroy(void)
+{
+   VG_(HT_destruct) (ht_resident, VG_(free));
+   VG_(HT_destruct) (ht_pfsites, VG_(free));
+   VG_(free) (pf_markov);
+   VG_(deleteXA) (pf_windows);
+}
+
+static
+void firsttouch_flush(void)
+{
+   if (ft_used > 0 && ft_fd >= 0) {
+      VG_(write) (ft_fd, ft_buf, ft_used * sizeof(ft_buf[0]));
+      ft_flushed += ft_used;
+   }
+   ft_used = 0;
+}
+
+/**
+ * @brief open a new log file next to the output file, named after this process
+ */
+static
+Int firsttouch_open(void)
+{
+   HChar *outfile = VG_(expand_file_name)("--ws-file", int_filename);
+   VG_(free) (ft_fname);
+   const SizeT len = VG_(strlen) (outfile) + 16;
+   ft_fname = VG_(malloc) (len);
+   VG_(snprintf) (ft_fname, len, "%s.ft.%d", outfile, VG_(getpid)());
+   VG_(free) (outfile);
+   const Int fd = VG_(fd_open) (ft_fname, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_RDWR,
+                                VKI_S_IRUSR|VKI_S_IWUSR);
+   if (fd < 0) VG_(umsg)("error: can't open first touch log '%s', not logging\n", ft_fname);
+   return fd;
+}
+
+/**
+ * @brief read back records [from, from + n) of a log file into buf
+ * @return number of records read
+ */
+static
+Int firsttouch_read(Int fd, FirstTouch *buf, ULong from, Int n)
+{
+   const SysRes res = VG_(pread) (fd, buf, n * sizeof(buf[0]), from * sizeof(buf[0]));
+   return sr_isError(res) ? 0 : sr_Res(res) / sizeof(buf[0]);
+}
+
+/**
+ * @brief record i of the log, read back in chunks of FT_BUFRECS. The log must
+ * be flushed, and is best read sequentially.
+ * @return NULL if it cannot be read
+ */
+static
+const FirstTouch* firsttouch_get(ULong i)
+{
+   if (i < ft_chunk || i - ft_chunk >= ft_chunk_n) {
+      ft_chunk = i;
+      ft_chunk_n = firsttouch_read (ft_fd, ft_buf, i, FT_BUFRECS);
+      if (ft_chunk_n == 0) return NULL;
+   }
+   return &ft_buf[i - ft_chunk];
+}
+
+/**
+ * @brief after fork the child would append to the parent's log. It gets its own
+ * file instead, with a copy of what the parent logged so far.
+ */
+static
+void firsttouch_atfork_child(ThreadId tid)
+{
+   if (ft_fd < 0) return;
+   const Int parent = ft_fd;
+   ft_fd = firsttouch_open();
+   if (ft_fd >= 0) {
+      FirstTouch *chunk = VG_(malloc) (FT_BUFRECS * sizeof(chunk[0]));
+      ULong copied = 0;
+      Int got = 1;
+      while (copied < ft_flushed && got > 0) {
+         const ULong left = ft_flushed - copied;
+         got = firsttouch_read (parent, chunk, copied, left < FT_BUFRECS ? left : FT_BUFRECS);
+         VG_(write) (ft_fd, chunk, got * sizeof(chunk[0]));
+         copied += got;
+      }
+      ft_flushed = copied;
+      VG_(free) (chunk);
+   }
+   VG_(close) (parent);
+}
 
-   // locality trackers
-   init_locality(&locality_data);
-   init_locality(&locality_insn);
+static
+void firsttouch_init(void)
+{
+   tl_assert(clo_pagesize >= 4);  // flags in the low bits of the page address
+   ft_fd      = firsttouch_open();
+   ft_samples = VG_(newXA) (VG_(malloc), "arr_ftsamples", VG_(free), sizeof(FirstTouchSample));
+   VG_(atfork) (NULL, NULL, firsttouch_atfork_child);
+}
 
-   // verbose a bit
-   VG_(umsg)("Page size = %d bytes\n", clo_pagesize);
-   VG_(umsg)("Computing WS every %d %s\n", clo_every,
-             TimeUnit_to_string(clo_time_unit));
-   VG_(umsg)("Considering references in past %d %s\n", clo_tau,
-             TimeUnit_to_string(clo_time_unit));
+/**
+ * @brief a page was inserted into the page table. The code site is the guest
+ * IP of the running thread, as far as it was updated at this point.
+ */
+static
+void firsttouch_log(VgHashTable *ht, Addr pageaddr, Bool write)
+{
+   const ThreadId tid = VG_(get_running_tid)();
+   FirstTouch ft;
+   ft.t = get_time();
+   ft.page = pageaddr;
+   if (ht == ht_data) {
+      ft.page |= FT_DATA | (write ? FT_WRITE : 0);
+      ft_new_data++;
+   } else {
+      ft_new_insn++;
+   }
+   ft.ip = tid < VG_N_THREADS ? VG_(get_IP) (tid) : 0;
+   ft.ep = VG_(current_DiEpoch)();
+   if (ft_used == FT_BUFRECS) firsttouch_flush();
+   ft_buf[ft_used++] = ft;
 }
 
 static
-void add_one_SB_entered(void)
+void firsttouch_sample(Time t, WorkingSet *ws, Bool *have_info)
 {
-   n_SBs_entered++;
+   static Time pre_t = 0;
+   const FirstTouchSample fs = { ft_new_insn, ft_new_data, t - pre_t };
+   VG_(addToXA) (ft_samples, &fs);
+   ft_new_insn = 0;
+   ft_new_data = 0;
+   pre_t = t;
 }
 
 static
-void add_one_SB_exited(void)
+void firsttouch_header(VgFile *fp)
 {
-   n_SBs_exited++;
+   VG_(fprintf) (fp, " %8s %8s", "newi/ki", "newd/ki");
 }
 
 /**
- * @brief instruments SB with a counter that increments by n, and is saved
- * into guest_instrs_executed.
+ * @brief footprint growth: pages touched for the first time per 1000 instructions
+ * since the previous sample
  */
 static
-void add_counter_update(IRSB* sbOut, Int n)
+void firsttouch_row(VgFile *fp, UInt sample)
 {
-   #if defined(VG_BIGENDIAN)
-      #define END Iend_BE
-   #elif defined(VG_LITTLEENDIAN)
-      #define END Iend_LE
-   #else
-      #error "Unknown endianness"
-   #endif
-   // Add code to increment 'guest_instrs_executed' by 'n', like this:
-   //   WrTmp(t1, Load64(&guest_instrs_executed))
-   //   WrTmp(t2, Add64(RdTmp(t1), Const(n)))
-   //   Store(&guest_instrs_executed, t2)
-   IRTemp t1 = newIRTemp(sbOut->tyenv, Ity_I64);
-   IRTemp t2 = newIRTemp(sbOut->tyenv, Ity_I64);
-   IRExpr* counter_addr = mkIRExpr_HWord( (HWord)&guest_instrs_executed );
+   const FirstTouchSample *fs = VG_(indexXA) (ft_samples, sample);
+   const Float ki = fs->dt > 0 ? fs->dt / 1000.f : 1.f;
+   VG_(fprintf) (fp, " %8.2f %8.2f", fs->insn / ki, fs->data / ki);
+}
 
-   IRStmt* st1 = IRStmt_WrTmp(t1, IRExpr_Load(END, Ity_I64, counter_addr));
-   IRStmt* st2 =
-      IRStmt_WrTmp(t2,
-                   IRExpr_Binop(Iop_Add64, IRExpr_RdTmp(t1),
-                                           IRExpr_Const(IRConst_U64(n))));
-   IRStmt* st3 = IRStmt_Store(END, counter_addr, IRExpr_RdTmp(t2));
+static
+Int map_ftsite_compare (const void *p1, const void *p2)
+{
+   const struct map_ftsite * const *a1 = (const struct map_ftsite * const *) p1;
+   const struct map_ftsite * const *a2 = (const struct map_ftsite * const *) p2;
 
-   addStmtToIRSB( sbOut, st1 );
-   addStmtToIRSB( sbOut, st2 );
-   addStmtToIRSB( sbOut, st3 );
+   if ((*a1)->pages > (*a2)->pages) return -1;
+   if ((*a1)->pages < (*a2)->pages) return 1;
+   return 0;
 }
 
-// iterate pages and count those accessed within (now_time - tau, now_time)
+/**
+ * @brief one phase: its growth, and the code sites which touched most new pages
+ */
 static
-unsigned long recently_used_pages(VgHashTable *ht, Time now_time)
+void print_firsttouch_phase(VgFile *fp, Int phase, Time start, Time len,
+                            pagecount insn, pagecount data, VgHashTable *ht)
 {
-   unsigned long cnt = 0;
+   VG_(fprintf) (fp, "\n%5d %14llu %10u %10u %8.2f", phase, start, insn, data,
+                 (insn + data) / (len / 1000.f));
 
-   Time tmin = 0;
-   if (clo_tau < now_time) tmin = now_time - clo_tau;
+   int nsites = 0;
+   const int nentry = VG_(HT_count_nodes) (ht);
+   struct map_ftsite **sites = VG_(malloc) ((nentry + 1) * sizeof (*sites));
+   VG_(HT_ResetIter) (ht);
+   VgHashNode *nd;
+   while ((nd = VG_(HT_Next) (ht)))
+      sites[nsites++] = (struct map_ftsite *) nd;
+   VG_(ssort) (sites, nsites, sizeof (sites[0]), map_ftsite_compare);
+   for (int i = 0; i < nsites && i < FT_TOP_SITES; i++) {
+      const HChar *where = VG_(describe_IP) (sites[i]->ep, sites[i]->top.key, NULL);
+      VG_(fprintf) (fp, "\n%20s %10llu %s", "", sites[i]->pages, where);
+   }
+   VG_(free) (sites);
+}
+
+/**
+ * @brief growth per phase, where the run is cut into FT_PHASES phases of equal
+ * length, and with --ws-first-touch=log the whole log
+ */
+static
+void print_firsttouch(VgFile *fp)
+{
+   firsttouch_flush();
+   const ULong n = ft_flushed;
+   pagecount insn = 0, data = 0, written = 0;
+   for (ULong i = 0; i < n; i++) {
+      const FirstTouch *ft = firsttouch_get (i);
+      if (ft == NULL) break;
+      if (!(ft->page & FT_DATA)) insn++;
+      else data++;
+      if (ft->page & FT_WRITE) written++;
+   }
+   const Time end = get_time();
+   const Time len = end / FT_PHASES + 1;
+   VG_(fprintf) (fp, "Pages touched:     %'u insn, %'u data (%'u first by a write)\n",
+                 insn, data, written);
+   VG_(fprintf) (fp, "Phases:            %d of %'llu %s\n", FT_PHASES, len,
+                 TimeUnit_to_string(clo_time_unit));
+   VG_(fprintf) (fp, "%5s %14s %10s %10s %8s top sites", "phase", "start", "new_insn",
+                 "new_data", "new/ki");
+
+   ULong i = 0;
+   for (Int phase = 0; phase < FT_PHASES; phase++) {
+      VgHashTable *ht = VG_(HT_construct) ("ht_ftsites");
+      pagecount pi = 0, pd = 0;
+      for (; i < n; i++) {
+         const FirstTouch *ft = firsttouch_get (i);
+         if (ft == NULL || ft->t >= (phase + 1) * len) break;
+         if (ft->page & FT_DATA) pd++;
+         else pi++;
+         struct map_ftsite *site = VG_(HT_lookup) (ht, ft->ip);
+         if (site == NULL) {
+            site = VG_(malloc) (sizeof(*site));
+            site->top.key = ft->ip;
+            site->ep = ft->ep;
+            site->pages = 0;
+            VG_(HT_add_node) (ht, (VgHashNode *) site);
+         }
+         site->pages++;
+      }
+      print_firsttouch_phase (fp, phase, phase * len, len, pi, pd, ht);
+      VG_(HT_destruct) (ht, VG_(free));
+   }
+
+   if (clo_firsttouch != FirstTouchLog) return;
+   VG_(fprintf) (fp, "\n\nLog:\n%14s %18s %4s %2s %18s", "t", "page", "kind", "rw", "ip");
+   for (i = 0; i < n; i++) {
+      const FirstTouch *ft = firsttouch_get (i);
+      if (ft == NULL) break;
+      const Addr page = ft->page & ~(Addr) (FT_DATA | FT_WRITE);
+      VG_(fprintf) (fp, "\n%14llu %018p %4s %2s %018p", ft->t, (void*)page,
+                    ft->page & FT_DATA ? "data" : "insn",
+                    !(ft->page & FT_DATA) ? "x" : ft->page & FT_WRITE ? "w" : "r",
+                    (void*)ft->ip);
+   }
+}
+
+/**
+ * @brief log first access to a page shortly after the window opened
+ */
+static
+void window_first_touch(VgHashTable *ht, Addr pageaddr)
+{
+   const Time now = get_time();
+   if (now >= window_head_end) return;
+   const WindowPage wp = { pageaddr, now, ht == ht_insn ? AccessInsn : AccessData };
+   VG_(addToXA) (window_head, &wp);
+}
 
+static
+void window_tail_pages(VgHashTable *ht, AccessKind kind, Time tmin)
+{
    VG_(HT_ResetIter)(ht);
    const VgHashNode *nd;
    while ((nd = VG_(HT_Next)(ht))) {
       const struct map_pageaddr *page = (const struct map_pageaddr *) nd;
-      if (page->last_access > tmin) cnt++;
+      if (page->last_access > tmin) {
+         const WindowPage wp = { page->top.key, page->last_access, kind };
+         VG_(addToXA) (window_tail, &wp);
+      }
    }
-   return cnt;
 }
 
 /**
- * @brief actually assemble callstack string
- * * XXX: do not change this function without according changes in strstack_maxlen()
+ * @brief end of the window: remember pages still in the WS. Instrumentation is
+ * removed at the next thread switch, until then accesses are still counted.
  */
 static
-void strstack_make
-(UInt n, DiEpoch ep, Addr ip, void* uu_opaque)
+void window_close(Time now)
 {
-   callstack_string *cs = (callstack_string*) uu_opaque;
+   tl_assert(window_state == WindowOpen);
+   window_state = WindowClosing;
+   window_stop = now;
+   const Time tmin = clo_tau < now ? now - clo_tau : 0;
+   window_tail_pages (ht_insn, AccessInsn, tmin);
+   window_tail_pages (ht_data, AccessData, tmin);
+}
 
-   // inlining
-   InlIPCursor *iipc = VG_(new_IIPC)(ep, ip);
-   do {
-      const HChar *fname;
-      UInt         line;
-      if (VG_(get_filename_linenum)(ep, ip, &fname, NULL, &line)) {
-         // format: "%s:%u"
-         VG_(strncat) (cs->str, fname, cs->rem); cs->rem -= VG_(strlen)(fname);
-         VG_(strncat) (cs->str, ":", cs->rem); cs->rem -= 1;
-         cs->rem -= VG_(snprintf) (cs->str + VG_(strlen) (cs->str), cs->rem, "%u", line);
-      }
-      // separator
-      VG_(strncat) (cs->str, "|", cs->rem); cs->rem -= 1;
-   } while (VG_(next_IIPC)(iipc));
+/**
+ * @brief open or close the window. Called whenever a thread resumes, which is
+ * outside of any translation. The window thus opens up to one time slice late.
+ */
+static
+void window_check(void)
+{
+   if (window_state == WindowBefore && get_time() >= (Time) clo_start_at) {
+      window_state = WindowOpen;
+      window_start = get_time();
+      window_head_end = window_start + clo_tau;
+      ws_at_time.first_t = window_start;
+      discard_own_translations ((Addr) 0x1000, ~(SizeT) 0xfff, "ws.window_open");
+   } else if (window_state == WindowClosing) {
+      window_state = WindowClosed;
+      discard_own_translations ((Addr) 0x1000, ~(SizeT) 0xfff, "ws.window_close");
+   }
 }
 
 /**
- * @brief determine max. length of callstack string
- * XXX: do not change this function without according changes in strstack_make()
+ * @brief called by the scheduler whenever a thread resumes
  */
 static
-void strstack_maxlen(UInt n, DiEpoch ep, Addr ip, void* uu_opaque)
+void ws_start_client_code(ThreadId tid, ULong blocks_done)
 {
-   callstack_string *cs = (callstack_string*) uu_opaque;
+   jit_translating = False;
+   if (clo_window) window_check ();
+   if (clo_tiered > 0) tier_check ();
+}
 
-   // inlining
-   InlIPCursor *iipc = VG_(new_IIPC)(ep, ip);
-   do {
-      const HChar *fname;
-      UInt         line;
-      if (VG_(get_filename_linenum)(ep, ip, &fname, NULL, &line)) {
-         // format: "%s:%u"
-         HChar buf[8];
-         cs->rem += VG_(strlen) (fname);
-         cs->rem += 1;
-         cs->rem += VG_(snprintf) (buf, sizeof(buf), "%u", line);
-      }
-      cs->rem += 1;  // trailing separator or NULL terminator.
-   } while (VG_(next_IIPC)(iipc));
-   VG_(delete_IIPC)(iipc);
+static
+void window_init(void)
+{
+   window_head = VG_(newXA) (VG_(malloc), "arr_winhead", VG_(free), sizeof(WindowPage));
+   window_tail = VG_(newXA) (VG_(malloc), "arr_wintail", VG_(free), sizeof(WindowPage));
+   if (clo_start_at > 0) {
+      window_state = WindowBefore;
+   } else {
+      window_head_end = clo_tau;
+   }
+   if (clo_stop_after > 0) window_stop_at = clo_start_at + clo_stop_after;
+}
+
+static
+void print_window_pages(VgFile *fp, XArray *xa, const HChar *list)
+{
+   for (Int i = 0; i < VG_(sizeXA) (xa); i++) {
+      const WindowPage *wp = VG_(indexXA) (xa, i);
+      VG_(fprintf) (fp, "\n%4s %4s %018p %14llu", list,
+                    wp->kind == AccessInsn ? "insn" : "data", (void*)wp->page, wp->t);
+   }
 }
 
 /**
- * @brief get callstack as string
+ * @brief state at the window boundaries, which valgrind-ws-merge.py needs to
+ * stitch the WSS of consecutive windows. Head lists the first access of pages
+ * touched within tau after the start, tail the last access of pages touched
+ * within tau before the stop.
  */
 static
-HChar* get_callstack(ExeContext *ec)
+void print_window_state(VgFile *fp)
 {
-   callstack_string cs;
-   const DiEpoch ep = VG_(get_ExeContext_epoch) (ec);
+   if (window_state == WindowBefore) {
+      VG_(fprintf) (fp, "Start:             - (requested %lld, window never opened)\n", clo_start_at);
+      VG_(fprintf) (fp, "Stop:              -");
+      return;
+   }
+   VG_(fprintf) (fp, "Start:             %llu (requested %lld)\n", window_start, clo_start_at);
+   if (clo_stop_after > 0) {
+      VG_(fprintf) (fp, "Stop:              %llu (requested %llu)\n", window_stop, window_stop_at);
+   } else {
+      VG_(fprintf) (fp, "Stop:              %llu (end of program)\n", window_stop);
+   }
+   VG_(fprintf) (fp, "Head/tail pages:   %'lu/%'lu\n",
+                 VG_(sizeXA) (window_head), VG_(sizeXA) (window_tail));
+   VG_(fprintf) (fp, "%4s %4s %18s %14s", "list", "kind", "page", "t");
+   print_window_pages (fp, window_head, "head");
+   print_window_pages (fp, window_tail, "tail");
+}
 
-   // pre-calculate length of string
-   cs.rem = 0;
-   VG_(apply_ExeContext) (strstack_maxlen, (void*)&cs, ep, ec);
+static
+void window_destroy(void)
+{
+   VG_(deleteXA) (window_head);
+   VG_(deleteXA) (window_tail);
+}
 
-   cs.rem += 1; // better than sorry
-   cs.str = (HChar*) VG_(malloc) (cs.rem * sizeof(HChar));
-   cs.str[0] = 0;
+/*------------------------------------------------------------*/
+/*--- analyses                                             ---*/
+/*------------------------------------------------------------*/
 
-   // assemble string
-   VG_(apply_ExeContext) (strstack_make, (void*)&cs, ep, ec);
-   cs.str[VG_(strlen) (cs.str) - 1] = 0;  // remove trailing separator
+/* To add an analysis: implement the hooks it needs, add a command line
+   flag for it, and an entry here. Output sections are written in this
+   order after the working set table. */
+static const Analysis analyses[] = {
+   { .name = "peaks", .enabled = &clo_peakdetect,
+     .init = peaks_init, .sample = peaks_sample },
+   { .name = "locality", .enabled = &clo_localitytr,
+     .init = locality_init, .access = locality_access,
+     .sb_entered = locality_sb_entered, .sb_exited = locality_sb_exited,
+     .section = "Locality statistics", .print = print_locality_stats },
+   { .name = "threads", .enabled = &clo_infothreads,
+     .init = threads_init, .page_entered = threads_page_entered,
+     .section = "Thread stacks", .print = print_thread_stacks },
+   { .name = "trace", .enabled = &clo_trace,
+     .init = trace_init, .access = trace_access, .sample = trace_sample,
+     .fini = trace_close },
+   { .name = "heap", .enabled = &clo_heap,
+     .init = heap_init, .sample = heap_sample,
+     .header = heap_header, .row = heap_row,
+     .section = "Heap sparse pages", .print = print_heap_sites },
+   { .name = "fields", .enabled = &clo_heapfields,
+     .init = fields_init, .access = fields_access, .page_entered = fields_page_entered,
+     .fini = fields_fini,
+     .section = "Heap fields", .print = print_heap_fields },
+   { .name = "pools", .enabled = &clo_mempools,
+     .init = pools_init, .sample = pools_sample,
+     .header = pools_header, .row = pools_row,
+     .section = "Memory pools", .print = print_pools },
+   { .name = "madvise", .enabled = &clo_madvise,
+     .init = madvise_init, .page_entered = madvise_page_entered, .sample = madvise_sample,
+     .header = madvise_header, .row = madvise_row,
+     .section = "Purges", .print = print_purge_stats },
+   { .name = "stacks", .enabled = &clo_stacks,
+     .init = stacks_init, .access = stacks_access, .sample = stacks_sample,
+     .fini = stacks_fini, .header = stacks_header, .row = stacks_row,
+     .section = "Stack usage", .print = print_stack_usage },
+   { .name = "jit", .enabled = &clo_jit,
+     .init = jit_init, .sample = jit_sample,
+     .header = jit_header, .row = jit_row,
+     .section = "Code cache", .print = print_jit_stats },
+   { .name = "volume", .enabled = &clo_volume,
+     .init = volume_init, .sample = volume_sample,
+     .header = volume_header, .row = volume_row },
+   { .name = "forecast", .enabled = &clo_forecasting,
+     .init = forecast_init, .sample = forecast_sample,
+     .header = forecast_header, .row = forecast_row,
+     .section = "Forecast", .print = print_forecast },
+   { .name = "prefetch", .enabled = &clo_prefetching,
+     .init = prefetch_init, .access = prefetch_access, .sample = prefetch_sample,
+     .fini = prefetch_fini,
+     .section = "Prefetch simulation", .print = print_prefetch },
+   { .name = "firsttouch", .enabled = &clo_firsttouching,
+     .init = firsttouch_init, .sample = firsttouch_sample,
+     .header = firsttouch_header, .row = firsttouch_row,
+     .section = "First touch", .print = print_firsttouch },
+   { .name = "window", .enabled = &clo_window,
+     .init = window_init,
+     .section = "Window state", .print = print_window_state },
+};
+#define N_ANALYSES (sizeof(analyses) / sizeof(analyses[0]))
 
-   return cs.str;
+/**
+ * @brief initialize enabled analyses and register their hooks
+ */
+static
+void analyses_init(void)
+{
+   tl_assert(N_ANALYSES <= MAX_ANALYSES);
+   for (Int i = 0; i < N_ANALYSES; i++) {
+      const Analysis *a = &analyses[i];
+      if (!*a->enabled) continue;
+      if (a->init)       a->init ();
+      if (a->access)     hook_access[n_hook_access++] = a;
+      if (a->page_entered) hook_page_entered[n_hook_page_entered++] = a;
+      if (a->sb_entered) hook_sb_entered[n_hook_sb_entered++] = a;
+      if (a->sb_exited)  hook_sb_exited[n_hook_sb_exited++] = a;
+      if (a->sample)     hook_sample[n_hook_sample++] = a;
+   }
+}
+
+static
+void analyses_fini(void)
+{
+   for (Int i = 0; i < N_ANALYSES; i++) {
+      if (*analyses[i].enabled && analyses[i].fini) analyses[i].fini ();
+   }
+}
+
+static
+void analyses_print(VgFile *fp)
+{
+   for (Int i = 0; i < N_ANALYSES; i++) {
+      const Analysis *a = &analyses[i];
+      if (!*a->enabled || !a->print) continue;
+      VG_(fprintf) (fp, "%s:\n", a->section);
+      a->print (fp);
+      VG_(fprintf) (fp, "\n--\n\n");
+   }
 }
 
 /**
- * @brief record additional information about process right now
+ * @brief extra columns of enabled analyses in the working set table
  */
 static
-void record_sample_info(Time now_time)
+void analyses_header(VgFile *fp)
 {
-   SampleContext *wsp = VG_(malloc) (sizeof(*wsp));
-   if (wsp) {
-      wsp->t = now_time;
-      if (!postmortem) {
-         ThreadId tid = VG_(get_running_tid)();
-         wsp->ec = VG_(record_ExeContext)(tid, 0);
-      } else {
-         wsp->ec = VG_(null_ExeContext)();
-      }
-      VG_(addToXA) (ws_context_list, &wsp);
+   for (Int i = 0; i < N_ANALYSES; i++) {
+      if (*analyses[i].enabled && analyses[i].header) analyses[i].header (fp);
+   }
+}
+
+static
+void analyses_row(VgFile *fp, UInt sample)
+{
+   for (Int i = 0; i < N_ANALYSES; i++) {
+      if (*analyses[i].enabled && analyses[i].row) analyses[i].row (fp, sample);
    }
 }
 
@@ -943,15 +4716,9 @@ void compute_ws(Time now_time)
    /*********
     * WSS
     *********/
-   WorkingSet *ws = VG_(malloc) (sizeof(WorkingSet));
-   if (!ws) {
-      drop_samples++;
-      return;
-   }
-   ws->t = now_time;
-   ws->pages_insn = recently_used_pages (ht_insn, now_time);
-   ws->pages_data = recently_used_pages (ht_data, now_time);
-   VG_(addToXA) (ws_at_time, &ws);
+   WorkingSet *ws = samples_add (&ws_at_time, now_time);
+   ws->pages_insn = recently_used_pages (ht_insn, &self_stats.insn, now_time);
+   ws->pages_data = recently_used_pages (ht_data, &self_stats.data, now_time);
 
    /*********
     * INFO
@@ -961,7 +4728,7 @@ void compute_ws(Time now_time)
    if (next_user_time_idx >= 0) {
       Time **nextt= VG_(indexXA) (ws_info_times, next_user_time_idx);
       if (now_time >= **nextt) {
-         record_sample_info (now_time);
+         record_sample_info ();
          have_info = True;
          // go to next one that is in the future (they might be too dense for --ws-every)
          do {
@@ -976,18 +4743,25 @@ void compute_ws(Time now_time)
       }
    }
 
-   if (clo_peakdetect) {
-      // both peak detect have to run every sample for uniformity, thus no short-circuit eval
-      const Bool pk_data = peak_detect(&pd_data, ws->pages_data);
-      const Bool pk_insn = peak_detect(&pd_insn, ws->pages_insn);
-      if (!have_info && (pk_data || pk_insn)) {
-         record_sample_info (now_time);
-      }
-      #ifdef DEBUG
-         ws->mAvg = pd_data.movingAvg;
-         ws->mVar = pd_data.movingVar;
-      #endif
+   for (Int i = 0; i < n_hook_sample; i++) hook_sample[i]->sample (now_time, ws, &have_info);
+}
+
+/**
+ * @brief compute_ws(), but timed if --ws-self-stats=yes
+ */
+static
+void compute_ws_timed(Time now_time)
+{
+   if (LIKELY(!clo_selfstats)) {
+      compute_ws (now_time);
+      return;
    }
+   const ULong c0 = read_cycles();
+   compute_ws (now_time);
+   const ULong dc = read_cycles() - c0;
+   self_stats.samples++;
+   self_stats.cyc_compute_ws += dc;
+   if (dc > self_stats.cyc_compute_max) self_stats.cyc_compute_max = dc;
 }
 
 static
@@ -996,13 +4770,61 @@ void maybe_compute_ws (void)
    tl_assert(clo_time_unit == TimeI);
 
    // if 'every' time units have passed, determine working set again
-   static Time earliest_possible_time_of_next_ws = 0;
    Time now_time = get_time();
-   if (now_time < earliest_possible_time_of_next_ws) return;
+   if (now_time < next_sample_time) return;
 
-   compute_ws (now_time);
+   compute_ws_timed (now_time);
+
+   if (now_time >= window_stop_at) {
+      window_close (now_time);
+      next_sample_time = (Time) -1;
+   } else {
+      next_sample_time = now_time + clo_every;
+      // last sample exactly at the end of the window
+      if (next_sample_time > window_stop_at)
+         next_sample_time = window_stop_at;
+   }
+}
+
+/**
+ * @brief whether guest code is in vgpreload_ws. Its allocator wrappers report
+ * heap blocks and its string functions their accesses by client request, see
+ * --ws-heap and --ws-bulk-ranges. Its instructions are only counted, and without
+ * both options not even that, so that it does not show in the results.
+ */
+static
+Bool in_preload(Addr a)
+{
+   const HChar *obj;
+   return VG_(get_objname) (VG_(current_DiEpoch)(), a, &obj) &&
+          VG_(strstr) (obj, "vgpreload_ws") != NULL;
+}
 
-   earliest_possible_time_of_next_ws = now_time + clo_every;
+/**
+ * @brief outside of the measurement window, and in vgpreload_ws, only count
+ * instructions
+ */
+static
+IRSB* instrument_count_only(IRSB* sbIn, IRSB* sbOut)
+{
+   const Bool sampling = window_state == WindowOpen;  // vgpreload_ws
+   Int ninsn = 0;
+   for (Int i = 0; i < sbIn->stmts_used; i++) {
+      IRStmt* st = sbIn->stmts[i];
+      if (!st || st->tag == Ist_NoOp) continue;
+      if (st->tag == Ist_IMark) ninsn++;
+      if (st->tag == Ist_Exit && ninsn > 0) {
+         add_counter_update(sbOut, ninsn);
+         if (sampling) add_sample_check(sbOut);
+         ninsn = 0;
+      }
+      addStmtToIRSB( sbOut, st );
+   }
+   if (ninsn > 0) {
+      add_counter_update(sbOut, ninsn);
+      if (sampling) add_sample_check(sbOut);
+   }
+   return sbOut;
 }
 
 static
@@ -1021,12 +4843,19 @@ IRSB* ws_instrument ( VgCallbackClosure* closure,
       /* We don't currently support this case. */
       VG_(tool_panic)("host/guest word size mismatch");
    }
+   jit_translating = True;  // the translation may evict others, see ws_discard_superblock_info
 
    sbOut = deepCopyIRSBExceptStmts(sbIn);
+   if (UNLIKELY(window_state != WindowOpen)) return instrument_count_only(sbIn, sbOut);
+   if (in_preload(vge->base[0])) {
+      if (!clo_bulk && !clo_heap) return sbIn;
+      return instrument_count_only(sbIn, sbOut);
+   }
+   tier_hot = clo_tiered > 0 && VG_(HT_lookup) (ht_hotsb, vge->base[0]) != NULL;
 
-   if (clo_localitytr) {
-      IRDirty* di = unsafeIRDirty_0_N( 0, "add_one_SB_entered",
-                        VG_(fnptr_to_fnentry)( &add_one_SB_entered ),
+   if (n_hook_sb_entered > 0) {
+      IRDirty* di = unsafeIRDirty_0_N( 0, "analyses_sb_entered",
+                        VG_(fnptr_to_fnentry)( &analyses_sb_entered ),
                         mkIRExprVec_0() );
       addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
    }
@@ -1037,6 +4866,7 @@ IRSB* ws_instrument ( VgCallbackClosure* closure,
       addStmtToIRSB( sbOut, sbIn->stmts[i] );
       i++;
    }
+   if (clo_tiered > 0 && !tier_hot) tier_count_sb(sbOut, vge);
 
    events_used = ninsn = 0;
    // instrument accesses and insn counter, if needed
@@ -1173,13 +5003,14 @@ IRSB* ws_instrument ( VgCallbackClosure* closure,
                add_counter_update(sbOut, ninsn);
                ninsn = 0;
             }
-            if (clo_localitytr) {
-               IRDirty* di = unsafeIRDirty_0_N( 0, "add_one_SB_exit",
-                                 VG_(fnptr_to_fnentry)( &add_one_SB_exited ),
+            if (n_hook_sb_exited > 0) {
+               IRDirty* di = unsafeIRDirty_0_N( 0, "analyses_sb_exited",
+                                 VG_(fnptr_to_fnentry)( &analyses_sb_exited ),
                                  mkIRExprVec_0() );
                addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
             }
             flushEvents(sbOut);
+            if (clo_track == TrackData && clo_time_unit == TimeI) add_sample_check(sbOut);
             addStmtToIRSB( sbOut, st );      // Original statement
             break;
 
@@ -1194,6 +5025,7 @@ IRSB* ws_instrument ( VgCallbackClosure* closure,
       add_counter_update(sbOut, ninsn);
    }
    flushEvents(sbOut);
+   if (clo_track == TrackData && clo_time_unit == TimeI) add_sample_check(sbOut);
 
    return sbOut;
 }
@@ -1301,7 +5133,7 @@ void print_access_stats(VgHashTable *ht, VgFile *fp)
 }
 
 static
-void print_ws_over_time(XArray *xa, VgHashTable *ht_sampleinfo, VgFile *fp)
+void print_ws_over_time(const SampleStore *ss, VgHashTable *ht_sampleinfo, VgFile *fp)
 {
    // header
    VG_(fprintf) (fp, "%12s %8s %8s", "t", "WSS_insn", "WSS_data");
@@ -1313,24 +5145,27 @@ void print_ws_over_time(XArray *xa, VgHashTable *ht_sampleinfo, VgFile *fp)
          VG_(fprintf) (fp, " %12s %12s", "mAvg", "mVar");
       #endif
    }
+   analyses_header (fp);
    VG_(fprintf) (fp, "\n");
 
    // sample info
    const int n_info = VG_(sizeXA)(ws_context_list);
    int info_id = 0;
-   SampleContext **next_info = (n_info > 0) ? VG_(indexXA)(ws_context_list, info_id++) : NULL;
+   SampleContext *next_info = (n_info > 0) ? VG_(indexXA)(ws_context_list, info_id++) : NULL;
 
    // data points
-   const int num_t = VG_(sizeXA)(xa);
+   const int num_t = ss->num;
    unsigned long peak_i = 0, peak_d = 0;
    //unsigned long long sum_i = 0, sum_d = 0;
 
    Float avg_d = 0.f, avg_i = 0.f, Sd = 0.f, Si = 0.f, avg_pre = 0.f;
-   for (int i = 0; i < num_t; i++) {
-      WorkingSet **ws = VG_(indexXA)(xa, i);
-      const unsigned long t = (unsigned long)(*ws)->t;
-      const unsigned long pi = (*ws)->pages_insn;
-      const unsigned long pd = (*ws)->pages_data;
+   SampleIter it = { 0, 0 };
+   Time tt;
+   WorkingSet *ws;
+   for (int i = 0; (ws = samples_next(ss, &it, &tt)) != NULL; i++) {
+      const unsigned long t = (unsigned long) tt;
+      const unsigned long pi = ws->pages_insn;
+      const unsigned long pd = ws->pages_data;
 
       // track stats (Welford's algorithm)
       avg_pre = avg_d;
@@ -1345,12 +5180,15 @@ void print_ws_over_time(XArray *xa, VgHashTable *ht_sampleinfo, VgFile *fp)
       // sample info, if present
       if (VG_(HT_count_nodes) (ht_sampleinfo) > 0) {
          char strinfo[5];
-         if (next_info && (*next_info)->t == t) {
-            const UInt ecid = VG_(get_ECU_from_ExeContext)((*next_info)->ec);
+         if (next_info && next_info->sample == i) {
+            const UInt ecid = VG_(get_ECU_from_ExeContext)(next_info->ec);
             struct map_context2sampleinfo *pki = VG_(HT_lookup) (ht_ec2sampleinfo, ecid);
             tl_assert(pki != NULL);
             VG_(snprintf) (strinfo, sizeof(strinfo), "%d", pki->info.id);
-            next_info = (info_id < n_info) ? VG_(indexXA)(ws_context_list, info_id++) : NULL;
+            // further contexts of the same sample are other threads
+            do {
+               next_info = (info_id < n_info) ? VG_(indexXA)(ws_context_list, info_id++) : NULL;
+            } while (next_info && next_info->sample == i);
          } else {
             VG_(snprintf) (strinfo, sizeof(strinfo), "-");
          }
@@ -1362,9 +5200,10 @@ void print_ws_over_time(XArray *xa, VgHashTable *ht_sampleinfo, VgFile *fp)
 
       if (clo_peakdetect) {
          #ifdef DEBUG
-            VG_(fprintf) (fp, " %10.1f %10.1f", (*ws)->mAvg, (*ws)->mVar);
+            VG_(fprintf) (fp, " %10.1f %10.1f", ws->mAvg, ws->mVar);
          #endif
       }
+      analyses_row (fp, i);
       VG_(fprintf) (fp, "\n");
    }
 
@@ -1398,12 +5237,12 @@ unsigned long compute_sample_info(XArray *xa)
 
    const int num_t = VG_(sizeXA)(xa);
    for (int i = 0; i < num_t; i++) {
-      SampleContext **wsp = VG_(indexXA)(xa, i);
-      const UInt ecid = VG_(get_ECU_from_ExeContext)((*wsp)->ec);
+      SampleContext *wsp = VG_(indexXA)(xa, i);
+      const UInt ecid = VG_(get_ECU_from_ExeContext)(wsp->ec);
       struct map_context2sampleinfo *pi = VG_(HT_lookup) (ht_ec2sampleinfo, ecid);
       if (pi == NULL) {
          num_unique++;
-         HChar *strcs = get_callstack((*wsp)->ec);
+         HChar *strcs = get_callstack(wsp->ec);
          pi = VG_(malloc) (sizeof(*pi));
          pi->top.key = ecid;
          pi->info.id = VG_(HT_count_nodes)(ht_ec2sampleinfo);
@@ -1426,30 +5265,101 @@ void free_sample_info(void *arg)
    VG_(free) (arg);
 }
 
+/**
+ * @brief print one line of self statistics, either to file or to user
+ */
+static
+void print_self_stats_line(VgFile *fp, const HChar *line)
+{
+   if (fp) VG_(fprintf) (fp, "%s\n", line);
+   else    VG_(umsg) ("%s\n", line);
+}
+
+/**
+ * @brief print self statistics (--ws-self-stats)
+ * @param fp output file, or NULL for the summary
+ * @param with_output include timings of writing the output file
+ */
 static
-void print_locality_stats(VgFile *fp)
+void print_self_stats(VgFile *fp, Bool with_output)
 {
-   VG_(fprintf) (fp, "Insn refs/avg dist: %'lu/%'lu\n",
-                 locality_insn.n,
-                 (unsigned long) (locality_insn.sum / ((Float)locality_insn.n)));
-   VG_(fprintf) (fp, "Data refs/avg dist: %'lu/%'lu\n",
-                 locality_data.n,
-                 (unsigned long) (locality_data.sum / ((Float)locality_data.n)));
-   VG_(fprintf) (fp, "SB len enter/exits: %.1f/%.1f\n",
-                 guest_instrs_executed / ((Float) n_SBs_entered),
-                 guest_instrs_executed / ((Float) n_SBs_exited));
+   HChar line[256];
+   const SelfStats *ss = &self_stats;
+   const unsigned long num_t = ws_at_time.num;
+   const unsigned long num_c = VG_(sizeXA) (ws_context_list);
+
+   print_self_stats_line (fp, "Self statistics:");
+   VG_(snprintf) (line, sizeof(line), "Helper calls:   insn %'llu, data %'llu, SB %'llu",
+                  ss->insn.helper_calls, ss->data.helper_calls, ss->helper_sb);
+   print_self_stats_line (fp, line);
+   VG_(snprintf) (line, sizeof(line), "Cache hits:     insn %u%%, data %u%%",
+                  percent(ss->insn.cache_hits, ss->insn.helper_calls),
+                  percent(ss->data.cache_hits, ss->data.helper_calls));
+   print_self_stats_line (fp, line);
+   VG_(snprintf) (line, sizeof(line), "Table lookups:  insn %'llu, data %'llu",
+                  ss->insn.lookups, ss->data.lookups);
+   print_self_stats_line (fp, line);
+   VG_(snprintf) (line, sizeof(line), "Table inserts:  insn %'llu, data %'llu",
+                  ss->insn.inserts, ss->data.inserts);
+   print_self_stats_line (fp, line);
+   VG_(snprintf) (line, sizeof(line), "Sample scans:   %'lu samples, %'llu nodes/sample",
+                  num_t, num_t > 0 ? (ss->insn.scan_nodes + ss->data.scan_nodes) / num_t : 0);
+   print_self_stats_line (fp, line);
+   VG_(snprintf) (line, sizeof(line), "compute_ws:     %'llu cycles/sample, %'llu max, %'llu total",
+                  ss->samples > 0 ? ss->cyc_compute_ws / ss->samples : 0,
+                  ss->cyc_compute_max, ss->cyc_compute_ws);
+   print_self_stats_line (fp, line);
+   if (with_output) {
+      VG_(snprintf) (line, sizeof(line), "Fini cycles:    last sample %'llu, sample info %'llu, "
+                     "page lists %'llu, ws table %'llu, total %'llu",
+                     ss->cyc_fini_sample, ss->cyc_fini_info, ss->cyc_fini_pages,
+                     ss->cyc_fini_table, ss->cyc_fini_total);
+   } else {
+      VG_(snprintf) (line, sizeof(line), "Fini cycles:    last sample %'llu, sample info %'llu",
+                     ss->cyc_fini_sample, ss->cyc_fini_info);
+   }
+   print_self_stats_line (fp, line);
+   VG_(snprintf) (line, sizeof(line), "Tool memory:    insn pages %'lu kB, data pages %'lu kB, "
+                  "samples %'lu kB, sample info %'lu kB",
+                  (unsigned long) (VG_(HT_count_nodes) (ht_insn) * sizeof(struct map_pageaddr) / 1024),
+                  (unsigned long) (VG_(HT_count_nodes) (ht_data) * sizeof(struct map_pageaddr) / 1024),
+                  (unsigned long) (VG_(sizeXA) (ws_at_time.chunks) *
+                                   (SAMPLES_PER_CHUNK * sizeof(WorkingSet) + sizeof(WorkingSet*)) / 1024),
+                  (unsigned long) ((num_c * sizeof(SampleContext) +
+                                    VG_(HT_count_nodes) (ht_ec2sampleinfo) *
+                                    sizeof(struct map_context2sampleinfo)) / 1024));
+   print_self_stats_line (fp, line);
+   if (clo_tiered > 0) {
+      VG_(snprintf) (line, sizeof(line), "Tiered:         %'llu SBs promoted, %'u counters "
+                     "(inline cache hits of hot SBs are not counted)",
+                     ss->tier_promoted, tier_nctr);
+      print_self_stats_line (fp, line);
+   }
 }
 
 static
 void ws_fini(Int exitcode)
 {
+   const ULong c_start = read_cycles();
+
    // force one last data point
    postmortem = True;
-   compute_ws(get_time());
+   if (window_state == WindowOpen) {
+      compute_ws(get_time());
+      if (clo_window) window_close (get_time());
+   }
+   const ULong c_sample = read_cycles();
+   analyses_fini();
 
    VG_(umsg)("Number of instructions: %'lu\n", (unsigned long) guest_instrs_executed);
-   VG_(umsg)("Number of samples:      %'lu\n", VG_(sizeXA) (ws_at_time));
-   VG_(umsg)("Dropped samples:        %'lu\n", drop_samples);
+   VG_(umsg)("Number of samples:      %'lu\n", (unsigned long) ws_at_time.num);
+
+   // compute sample info
+   const unsigned long ninfo = compute_sample_info(ws_context_list);
+   VG_(umsg)("Number of info/unique: %lu/%lu\n", VG_(sizeXA)(ws_context_list), ninfo);
+   const ULong c_info = read_cycles();
+   self_stats.cyc_fini_sample = c_sample - c_start;
+   self_stats.cyc_fini_info = c_info - c_sample;
 
    HChar* outfile = VG_(expand_file_name)("--ws-file", int_filename);
    VG_(umsg)("Writing results to file '%s'\n", outfile);
@@ -1478,31 +5388,40 @@ void ws_fini(Int exitcode)
       VG_(fprintf) (fp, "Page size:      %d B\n", clo_pagesize);
       VG_(fprintf) (fp, "Time Unit:      %s\n", TimeUnit_to_string(clo_time_unit));
       VG_(fprintf) (fp, "Every:          %'d units\n", clo_every);
+      if (clo_track != TrackBoth)
+         VG_(fprintf) (fp, "Tracked:        %s pages only\n", clo_track == TrackInsn ? "insn" : "data");
       VG_(fprintf) (fp, "Tau:            %'d units\n\n", clo_tau);
       if (clo_peakdetect) {
          VG_(fprintf) (fp, "Peak window:    %'d\n", clo_peakwindow);
          VG_(fprintf) (fp, "Peak threshold: %d\n", clo_peakthresh);
          VG_(fprintf) (fp, "Peak adaptrate: %.1f\n", clo_peakadapt);
       }
+      if (clo_selfstats) {
+         if (clo_peakdetect) VG_(fprintf) (fp, "\n");
+         print_self_stats (fp, False);
+      }
       VG_(fprintf) (fp, "--\n\n");
 
       // show page listing
+      const ULong c_pages = read_cycles();
       if (clo_listpages) {
          VG_(fprintf) (fp, "Code pages, ");
          print_page_list (ht_insn, fp);
          VG_(fprintf) (fp, "\nData pages, ");
          print_page_list (ht_data, fp);
          VG_(fprintf) (fp, "\n--\n\n");
+         VG_(fprintf) (fp, "Mappings, ");
+         print_mappings (fp);
+         VG_(fprintf) (fp, "\n--\n\n");
       }
 
-      // compute sample info
-      const unsigned long ninfo = compute_sample_info(ws_context_list);
-      VG_(umsg)("Number of info/unique: %lu/%lu\n", VG_(sizeXA)(ws_context_list), ninfo);
-
       // show working set data
+      const ULong c_table = read_cycles();
       VG_(fprintf) (fp, "Working sets:\n");
-      print_ws_over_time (ws_at_time, ht_ec2sampleinfo, fp);
+      print_ws_over_time (&ws_at_time, ht_ec2sampleinfo, fp);
       VG_(fprintf) (fp, "\n--\n\n");
+      self_stats.cyc_fini_pages = c_table - c_pages;
+      self_stats.cyc_fini_table = read_cycles() - c_table;
 
       // show sample info.
       if (VG_(HT_count_nodes) (ht_ec2sampleinfo) > 0) {
@@ -1513,22 +5432,43 @@ void ws_fini(Int exitcode)
          VG_(fprintf) (fp, "\n--\n\n");
       }
 
-      // locality info
-      if (clo_localitytr) {
-         VG_(fprintf) (fp, "Locality statistics:\n");
-         print_locality_stats (fp);
-         VG_(fprintf) (fp, "\n--\n\n");
-      }
+      // sections of analyses
+      analyses_print (fp);
    }
 
+   self_stats.cyc_fini_total = read_cycles() - c_start;
+   if (clo_selfstats) print_self_stats (NULL, True);
+
    // cleanup
    VG_(fclose)(fp);
    VG_(HT_destruct) (ht_data, VG_(free));
    VG_(HT_destruct) (ht_insn, VG_(free));
    VG_(HT_destruct) (ht_ec2sampleinfo, free_sample_info);
-   VG_(deleteXA) (ws_at_time);
+   samples_destroy (&ws_at_time);
    VG_(deleteXA) (ws_context_list);
    VG_(deleteXA) (ws_info_times);
+   if (clo_heap) heap_destroy ();
+   if (clo_mempools) pools_destroy ();
+   if (clo_madvise) madvise_destroy ();
+   if (clo_stacks) stacks_destroy ();
+   if (clo_jit) jit_destroy ();
+   if (clo_volume) VG_(deleteXA) (volume_samples);
+   if (clo_window) window_destroy ();
+   if (clo_tiered > 0) tier_destroy ();
+   if (clo_listpages) mappings_destroy ();
+   if (clo_forecasting) {
+      VG_(deleteXA) (forecast_samples);
+      VG_(free) (forecast_ring);
+   }
+   if (clo_prefetching) prefetch_destroy ();
+   if (clo_firsttouching) {
+      if (ft_fd >= 0) {
+         VG_(close) (ft_fd);
+         VG_(unlink) (ft_fname);
+      }
+      VG_(free) (ft_fname);
+      VG_(deleteXA) (ft_samples);
+   }
    if (int_filename != clo_filename) VG_(free) ((void*)int_filename);
    VG_(umsg)("ws finished\n");
 }
@@ -1549,12 +5489,16 @@ void ws_pre_clo_init(void)
    VG_(needs_command_line_options)(ws_process_cmd_line_option,
                                    ws_print_usage,
                                    ws_print_debug_usage);
+   VG_(needs_client_requests)     (ws_handle_client_request);
+   VG_(needs_syscall_wrapper)     (ws_pre_syscall,
+                                   ws_post_syscall);
+   VG_(needs_superblock_discards) (ws_discard_superblock_info);
 
    ht_data          = VG_(HT_construct) ("ht_data");
    ht_insn          = VG_(HT_construct) ("ht_insn");
    ht_ec2sampleinfo = VG_(HT_construct) ("ht_ec2sampleinfo");
-   ws_at_time       = VG_(newXA) (VG_(malloc), "arr_ws",   VG_(free), sizeof(WorkingSet*));
-   ws_context_list  = VG_(newXA) (VG_(malloc), "arr_info", VG_(free), sizeof(SampleContext*));
+   samples_init (&ws_at_time);
+   ws_context_list  = VG_(newXA) (VG_(malloc), "arr_info", VG_(free), sizeof(SampleContext));
    ws_info_times    = VG_(newXA) (VG_(malloc), "arr_time", VG_(free), sizeof(Time*));
 }
 
@@ -0,0 +1,348 @@
+/*--------------------------------------------------------------------*/
+/*--- Allocator wrappers and string functions for ws. ws_preload.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of ws.
+
+   Copyright (C) 2018 Martin Becker
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Runs on the simulated CPU, as part of the client. Unlike the
+   replacements in vg_replace_malloc.c, these wrap the client's allocator:
+   the original function is called, and only the resulting block is
+   reported to the tool. Heap layout and fragmentation are thus the ones
+   of the allocator under test, not of valgrind's.
+
+   Wrapped are the functions in libc, and in the object named by
+   --soname-synonyms=somalloc=... (e.g. a statically linked jemalloc is
+   somalloc=NONE). operator new/delete are not wrapped, since libstdc++
+   implements them with malloc/free.
+
+   The string functions below wrap those of libc, including the __GI_
+   aliases libc calls internally. With --ws-bulk-ranges=yes they copy and
+   fill here instead, and report what they read and write as two ranges in
+   one client request. The tool does not instrument the accesses of this
+   object then, so a large memcpy costs one request instead of a helper
+   call per load and store. Otherwise they call the original function. */
+
+#include "pub_tool_basics.h"
+#include "pub_tool_redir.h"
+#include "valgrind.h"
+#include "ws.h"
+
+#define SO_SYN_MALLOC VG_SO_SYN(somalloc)
+
+/* --ws-heap, asked once. Without it, the wrappers only call the original. */
+static Int ws_heap = -1;
+
+static Int ws_heap_tracking(void)
+{
+   if (ws_heap < 0) ws_heap = VALGRIND_WS_HEAP_TRACKING();
+   return ws_heap;
+}
+
+/*------------------------------------------------------------*/
+/*--- wrapper generators                                   ---*/
+/*------------------------------------------------------------*/
+
+/* void* fn(SizeT n), e.g. malloc */
+#define ALLOC_W(soname, fnname)                                        \
+   void* I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (SizeT n);            \
+   void* I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (SizeT n)             \
+   {                                                                   \
+      void  *p;                                                        \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      CALL_FN_W_W(p, fn, n);                                           \
+      if (p && ws_heap_tracking()) VALGRIND_WS_HEAP_ALLOC(p, n);       \
+      return p;                                                        \
+   }
+
+/* void* fn(SizeT alignment, SizeT n), e.g. memalign */
+#define ALLOC_AW(soname, fnname)                                       \
+   void* I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (SizeT al, SizeT n);  \
+   void* I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (SizeT al, SizeT n)   \
+   {                                                                   \
+      void  *p;                                                        \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      CALL_FN_W_WW(p, fn, al, n);                                      \
+      if (p && ws_heap_tracking()) VALGRIND_WS_HEAP_ALLOC(p, n);       \
+      return p;                                                        \
+   }
+
+/* void* calloc(SizeT nmemb, SizeT size) */
+#define CALLOC(soname, fnname)                                         \
+   void* I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (SizeT nmemb, SizeT size); \
+   void* I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (SizeT nmemb, SizeT size)  \
+   {                                                                   \
+      void  *p;                                                        \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      CALL_FN_W_WW(p, fn, nmemb, size);                                \
+      if (p && ws_heap_tracking())                                     \
+         VALGRIND_WS_HEAP_ALLOC(p, nmemb * size);                      \
+      return p;                                                        \
+   }
+
+/* void* realloc(void *old, SizeT n). A failed realloc keeps the old block. */
+#define REALLOC(soname, fnname)                                        \
+   void* I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (void *old, SizeT n); \
+   void* I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (void *old, SizeT n)  \
+   {                                                                   \
+      void  *p;                                                        \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      CALL_FN_W_WW(p, fn, old, n);                                     \
+      if (!ws_heap_tracking()) return p;                               \
+      if (p) {                                                         \
+         if (old && old != p) VALGRIND_WS_HEAP_FREE(old);              \
+         VALGRIND_WS_HEAP_ALLOC(p, n);                                 \
+      } else if (old && n == 0) {                                      \
+         VALGRIND_WS_HEAP_FREE(old);                                   \
+      }                                                                \
+      return p;                                                        \
+   }
+
+/* int posix_memalign(void **memptr, SizeT alignment, SizeT n) */
+#define POSIX_MEMALIGN(soname, fnname)                                 \
+   int I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (void **memptr, SizeT al, SizeT n); \
+   int I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (void **memptr, SizeT al, SizeT n)  \
+   {                                                                   \
+      int    err;                                                      \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      CALL_FN_W_WWW(err, fn, memptr, al, n);                           \
+      if (err == 0 && *memptr && ws_heap_tracking())                   \
+         VALGRIND_WS_HEAP_ALLOC(*memptr, n);                           \
+      return err;                                                      \
+   }
+
+/* void free(void *p). Reported before the block can be reused. */
+#define FREE(soname, fnname)                                           \
+   void I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (void *p);             \
+   void I_WRAP_SONAME_FNNAME_ZU(soname, fnname) (void *p)              \
+   {                                                                   \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      if (p && ws_heap_tracking()) VALGRIND_WS_HEAP_FREE(p);           \
+      CALL_FN_v_W(fn, p);                                              \
+   }
+
+/*------------------------------------------------------------*/
+/*--- string functions                                     ---*/
+/*------------------------------------------------------------*/
+
+/* AM_CFLAGS_PSO builds with -fno-builtin, so these loops are not turned
+   back into calls of the functions they wrap. */
+
+/* memmove semantics, word by word where both ends are aligned */
+static void ws_move(void *dst, const void *src, SizeT n)
+{
+   UChar       *d = dst;
+   const UChar *s = src;
+   if (d == s || n == 0) return;
+   if (d < s || d >= s + n) {
+      if ((((Addr) d | (Addr) s) & (sizeof(UWord) - 1)) == 0) {
+         for (; n >= sizeof(UWord); n -= sizeof(UWord)) {
+            *(UWord *) d = *(const UWord *) s;
+            d += sizeof(UWord);
+            s += sizeof(UWord);
+         }
+      }
+      while (n--) *d++ = *s++;
+   } else {
+      d += n;
+      s += n;
+      while (n--) *--d = *--s;
+   }
+}
+
+static void ws_fill(void *dst, Int c, SizeT n)
+{
+   UChar *d = dst;
+   if (((Addr) d & (sizeof(UWord) - 1)) == 0) {
+      UWord w = (UChar) c;
+      w |= w << 8;
+      w |= w << 16;
+      if (sizeof(UWord) == 8) w |= (w << 16) << 16;
+      for (; n >= sizeof(UWord); n -= sizeof(UWord)) {
+         *(UWord *) d = w;
+         d += sizeof(UWord);
+      }
+   }
+   while (n--) *d++ = (UChar) c;
+}
+
+static SizeT ws_strnlen(const HChar *s, SizeT max)
+{
+   SizeT n = 0;
+   while (n < max && s[n]) n++;
+   return n;
+}
+
+/* --ws-bulk-ranges, asked once */
+static Int ws_bulk = -1;
+
+static Int ws_bulk_ranges(void)
+{
+   if (ws_bulk < 0) ws_bulk = VALGRIND_WS_BULK_RANGES();
+   return ws_bulk;
+}
+
+/* void* memcpy(void *dst, const void *src, SizeT n), also for memmove */
+#define MEMMOVE(tag, soname, fnname)                                   \
+   void* VG_WRAP_FUNCTION_EZU(tag, soname, fnname)                     \
+            (void *dst, const void *src, SizeT n);                     \
+   void* VG_WRAP_FUNCTION_EZU(tag, soname, fnname)                     \
+            (void *dst, const void *src, SizeT n)                      \
+   {                                                                   \
+      void  *r;                                                        \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      if (!ws_bulk_ranges()) {                                         \
+         CALL_FN_W_WWW(r, fn, dst, src, n);                            \
+         return r;                                                     \
+      }                                                                \
+      VALGRIND_WS_ACCESS_RANGES(dst, n, src, n);                       \
+      ws_move(dst, src, n);                                            \
+      return dst;                                                      \
+   }
+
+/* void* memset(void *dst, int c, SizeT n) */
+#define MEMSET(tag, soname, fnname)                                    \
+   void* VG_WRAP_FUNCTION_EZU(tag, soname, fnname)                     \
+            (void *dst, Int c, SizeT n);                               \
+   void* VG_WRAP_FUNCTION_EZU(tag, soname, fnname)                     \
+            (void *dst, Int c, SizeT n)                                \
+   {                                                                   \
+      void  *r;                                                        \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      if (!ws_bulk_ranges()) {                                         \
+         CALL_FN_W_WWW(r, fn, dst, c, n);                              \
+         return r;                                                     \
+      }                                                                \
+      VALGRIND_WS_ACCESS_RANGES(dst, n, 0, 0);                         \
+      ws_fill(dst, c, n);                                              \
+      return dst;                                                      \
+   }
+
+/* void bzero(void *dst, SizeT n) */
+#define BZERO(tag, soname, fnname)                                     \
+   void VG_WRAP_FUNCTION_EZU(tag, soname, fnname)                      \
+            (void *dst, SizeT n);                                      \
+   void VG_WRAP_FUNCTION_EZU(tag, soname, fnname)                      \
+            (void *dst, SizeT n)                                       \
+   {                                                                   \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      if (!ws_bulk_ranges()) {                                         \
+         CALL_FN_v_WW(fn, dst, n);                                     \
+         return;                                                       \
+      }                                                                \
+      VALGRIND_WS_ACCESS_RANGES(dst, n, 0, 0);                         \
+      ws_fill(dst, 0, n);                                              \
+   }
+
+/* char* strcpy(char *dst, const char *src); stpcpy returns the end instead */
+#define STRCPY(tag, soname, fnname, ret_end)                           \
+   HChar* VG_WRAP_FUNCTION_EZU(tag, soname, fnname)                    \
+            (HChar *dst, const HChar *src);                            \
+   HChar* VG_WRAP_FUNCTION_EZU(tag, soname, fnname)                    \
+            (HChar *dst, const HChar *src)                             \
+   {                                                                   \
+      HChar *r;                                                        \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      if (!ws_bulk_ranges()) {                                         \
+         CALL_FN_W_WW(r, fn, dst, src);                                \
+         return r;                                                     \
+      }                                                                \
+      const SizeT n = ws_strnlen(src, (SizeT) -1) + 1;                 \
+      VALGRIND_WS_ACCESS_RANGES(dst, n, src, n);                       \
+      ws_move(dst, src, n);                                            \
+      return (ret_end) ? dst + n - 1 : dst;                            \
+   }
+
+/* char* strncpy(char *dst, const char *src, SizeT n). The rest of dst is
+   zeroed. */
+#define STRNCPY(tag, soname, fnname)                                   \
+   HChar* VG_WRAP_FUNCTION_EZU(tag, soname, fnname)                    \
+            (HChar *dst, const HChar *src, SizeT n);                   \
+   HChar* VG_WRAP_FUNCTION_EZU(tag, soname, fnname)                    \
+            (HChar *dst, const HChar *src, SizeT n)                    \
+   {                                                                   \
+      HChar *r;                                                        \
+      OrigFn fn;                                                       \
+      VALGRIND_GET_ORIG_FN(fn);                                        \
+      if (!ws_bulk_ranges()) {                                         \
+         CALL_FN_W_WWW(r, fn, dst, src, n);                            \
+         return r;                                                     \
+      }                                                                \
+      const SizeT m = ws_strnlen(src, n);                              \
+      VALGRIND_WS_ACCESS_RANGES(dst, n, src, m < n ? m + 1 : m);       \
+      ws_move(dst, src, m);                                            \
+      ws_fill(dst + m, 0, n - m);                                      \
+      return dst;                                                      \
+   }
+
+/*------------------------------------------------------------*/
+/*--- wrapped functions                                    ---*/
+/*------------------------------------------------------------*/
+
+#if defined(VGO_linux)
+ ALLOC_W(VG_Z_LIBC_SONAME,        malloc);
+ ALLOC_W(SO_SYN_MALLOC,           malloc);
+ ALLOC_W(VG_Z_LIBC_SONAME,        valloc);
+ ALLOC_W(SO_SYN_MALLOC,           valloc);
+ ALLOC_AW(VG_Z_LIBC_SONAME,       memalign);
+ ALLOC_AW(SO_SYN_MALLOC,          memalign);
+ ALLOC_AW(VG_Z_LIBC_SONAME,       alignedZualloc);
+ ALLOC_AW(SO_SYN_MALLOC,          alignedZualloc);
+ CALLOC(VG_Z_LIBC_SONAME,         calloc);
+ CALLOC(SO_SYN_MALLOC,            calloc);
+ REALLOC(VG_Z_LIBC_SONAME,        realloc);
+ REALLOC(SO_SYN_MALLOC,           realloc);
+ POSIX_MEMALIGN(VG_Z_LIBC_SONAME, posixZumemalign);
+ POSIX_MEMALIGN(SO_SYN_MALLOC,    posixZumemalign);
+ FREE(VG_Z_LIBC_SONAME,           free);
+ FREE(SO_SYN_MALLOC,              free);
+
+ /* memcpy@GLIBC_2.2.5 has memmove semantics, as has our memcpy */
+ MEMMOVE(20180, VG_Z_LIBC_SONAME, memcpyZAGLIBCZu2Zd2Zd5);
+ MEMMOVE(20180, VG_Z_LIBC_SONAME, memcpyZAZAGLIBCZu2Zd14);
+ MEMMOVE(20180, VG_Z_LIBC_SONAME, __GI_memcpy);
+ MEMMOVE(20181, VG_Z_LIBC_SONAME, memmove);
+ MEMMOVE(20181, VG_Z_LIBC_SONAME, __GI_memmove);
+ MEMSET(20210,  VG_Z_LIBC_SONAME, memset);
+ BZERO(20230,   VG_Z_LIBC_SONAME, bzero);
+ STRCPY(20090,  VG_Z_LIBC_SONAME, strcpy,      0);
+ STRCPY(20090,  VG_Z_LIBC_SONAME, __GI_strcpy, 0);
+ STRCPY(20200,  VG_Z_LIBC_SONAME, stpcpy,      1);
+ STRCPY(20200,  VG_Z_LIBC_SONAME, __GI_stpcpy, 1);
+ STRNCPY(20100, VG_Z_LIBC_SONAME, strncpy);
+ STRNCPY(20100, VG_Z_LIBC_SONAME, __GI_strncpy);
+#endif
+
+/*--------------------------------------------------------------------*/
+/*--- end                                             ws_preload.c ---*/
+/*--------------------------------------------------------------------*/